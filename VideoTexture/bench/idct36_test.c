@@ -0,0 +1,126 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+/*
+Audio synthesis IDCT regression test.
+
+Compares the IDCT selected by plm_audio_select_synthesis(), which is
+the SSE2 or NEON version where available, against the scalar
+plm_audio_idct36() on random subband samples. Samples are drawn at
+every magnitude from 1 bit up to the full int range, and each block
+is run with every ss and dp the decoder can pass. Exits non-zero if
+any output float differs in any bit.
+
+Build with VTEX_BUILD_BENCHMARKS enabled.
+
+*/
+
+#define PL_MPEG_IMPLEMENTATION
+#include "../src/pl_mpeg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCKS_PER_SHIFT 2000
+
+static uint32_t random_state = 0x2545F491;
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+//a value with at most shift magnitude bits, sometimes zero
+static int random_sample(int shift) {
+    uint32_t r = next_random();
+    if ((r & 7) == 0) {
+        return 0;
+    }
+    int64_t range = (int64_t)1 << shift;
+    int64_t value = (int64_t)(next_random() % (uint64_t)(2 * range)) - range;
+    if (value > INT32_MAX) {
+        value = INT32_MAX;
+    }
+    return (int)value;
+}
+
+int main(void) {
+    plm_audio_t audio;
+    memset(&audio, 0, sizeof(audio));
+    plm_audio_select_synthesis(&audio);
+
+    if (audio.idct36 == plm_audio_idct36) {
+        printf("No SIMD IDCT in this build, comparing the scalar version with itself\n");
+    }
+
+    static int s[32][3];
+    static float expected[1024];
+    static float actual[1024];
+
+    long blocks = 0;
+    long mismatches = 0;
+
+    for (int shift = 0; shift <= 31; shift++) {
+        for (int block = 0; block < BLOCKS_PER_SHIFT; block++) {
+            for (int i = 0; i < 32; i++) {
+                for (int j = 0; j < 3; j++) {
+                    s[i][j] = random_sample(shift);
+                }
+            }
+
+            //v_pos steps back through the 1024 entry V buffer 64 at a time
+            for (int ss = 0; ss < 3; ss++) {
+                for (int dp = 0; dp < 1024; dp += 64) {
+                    memset(expected, 0x55, sizeof(expected));
+                    memset(actual, 0x55, sizeof(actual));
+                    plm_audio_idct36(s, ss, expected, dp);
+                    audio.idct36(s, ss, actual, dp);
+                    blocks++;
+
+                    if (memcmp(expected, actual, sizeof(expected)) != 0) {
+                        if (mismatches++ < 10) {
+                            for (int k = 0; k < 1024; k++) {
+                                if (memcmp(&expected[k], &actual[k], sizeof(float)) != 0) {
+                                    printf("shift %d ss %d dp %d index %d: %a != %a\n", shift, ss, dp, k, expected[k], actual[k]);
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("%ld blocks, %ld mismatches\n", blocks, mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+/*
+Motion compensation microbenchmark.
+
+Times plm_video_process_macroblock(), which uses SSE2 or NEON where
+available, against the scalar per-pixel loops it replaced, for all
+eight copy / half-pel / interpolate cases at both block sizes. The
+output of each case is compared first, so this fails if the two
+versions don't produce identical bytes.
+
+Build with VTEX_BUILD_BENCHMARKS enabled, in Release.
+
+*/
+
+#define PL_MPEG_IMPLEMENTATION
+#include "../src/pl_mpeg.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MB_WIDTH 22
+#define MB_HEIGHT 18
+#define ITERATIONS 2000000
+
+//the scalar path, as compiled when PLM_NO_SIMD is defined
+static void process_macroblock_scalar(
+    plm_video_t *self, uint8_t *s, uint8_t *d,
+    int motion_h, int motion_v, int block_size, int interpolate
+) {
+    int dw = self->mb_width * block_size;
+
+    int hp = motion_h >> 1;
+    int vp = motion_v >> 1;
+    int odd_h = (motion_h & 1) == 1;
+    int odd_v = (motion_v & 1) == 1;
+
+    unsigned int si = ((self->mb_row * block_size) + vp) * dw + (self->mb_col * block_size) + hp;
+    unsigned int di = (self->mb_row * dw + self->mb_col) * block_size;
+
+    unsigned int max_address = (dw * (self->mb_height * block_size - block_size + 1) - block_size);
+    if (si > max_address || di > max_address) {
+        return;
+    }
+
+    #define BENCH_CASE(INTERPOLATE, ODD_H, ODD_V, OP) \
+        case ((INTERPOLATE << 2) | (ODD_H << 1) | (ODD_V)): \
+            PLM_BLOCK_SET(d, di, dw, si, dw, block_size, OP); \
+            break
+
+    switch ((interpolate << 2) | (odd_h << 1) | (odd_v)) {
+        BENCH_CASE(0, 0, 0, (s[si]));
+        BENCH_CASE(0, 0, 1, (s[si] + s[si + dw] + 1) >> 1);
+        BENCH_CASE(0, 1, 0, (s[si] + s[si + 1] + 1) >> 1);
+        BENCH_CASE(0, 1, 1, (s[si] + s[si + 1] + s[si + dw] + s[si + dw + 1] + 2) >> 2);
+
+        BENCH_CASE(1, 0, 0, (d[di] + (s[si]) + 1) >> 1);
+        BENCH_CASE(1, 0, 1, (d[di] + ((s[si] + s[si + dw] + 1) >> 1) + 1) >> 1);
+        BENCH_CASE(1, 1, 0, (d[di] + ((s[si] + s[si + 1] + 1) >> 1) + 1) >> 1);
+        BENCH_CASE(1, 1, 1, (d[di] + ((s[si] + s[si + 1] + s[si + dw] + s[si + dw + 1] + 2) >> 2) + 1) >> 1);
+    }
+
+    #undef BENCH_CASE
+}
+
+typedef void (*process_func)(plm_video_t *, uint8_t *, uint8_t *, int, int, int, int);
+
+//a volatile pointer stops the compiler specialising the call for the benchmark
+static double time_case(volatile process_func func, plm_video_t *video, uint8_t *s, uint8_t *d, int block_size, int odd_h, int odd_v, int interpolate) {
+    clock_t start = clock();
+    for (int i = 0; i < ITERATIONS; i++) {
+        //walk the blocks so that they don't all stay in L1
+        video->mb_col = 1 + (i % (MB_WIDTH - 2));
+        video->mb_row = 1 + ((i / (MB_WIDTH - 2)) % (MB_HEIGHT - 2));
+        process_func f = func;
+        f(video, s, d, 2 + odd_h, 2 + odd_v, block_size, interpolate);
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1000000000.0 / ITERATIONS;
+}
+
+int main(void) {
+    static const char *names[] = {
+        "copy", "half-pel v", "half-pel h", "half-pel hv",
+        "interp copy", "interp half-pel v", "interp half-pel h", "interp half-pel hv"
+    };
+
+    size_t size = (size_t)MB_WIDTH * 16 * MB_HEIGHT * 16;
+    uint8_t *source = (uint8_t *)malloc(size);
+    uint8_t *dest_scalar = (uint8_t *)malloc(size);
+    uint8_t *dest_simd = (uint8_t *)malloc(size);
+
+    srand(1);
+    for (size_t i = 0; i < size; i++) {
+        source[i] = (uint8_t)rand();
+        dest_scalar[i] = (uint8_t)rand();
+    }
+
+    plm_video_t video;
+    memset(&video, 0, sizeof(video));
+    video.mb_width = MB_WIDTH;
+    video.mb_height = MB_HEIGHT;
+
+    int failed = 0;
+    printf("%-20s %5s %12s %12s %8s\n", "case", "block", "scalar ns", "simd ns", "speedup");
+
+    for (int block_size = 8; block_size <= 16; block_size += 8) {
+        for (int c = 0; c < 8; c++) {
+            int interpolate = (c >> 2) & 1;
+            int odd_h = (c >> 1) & 1;
+            int odd_v = c & 1;
+
+            //check every block position before timing anything
+            memcpy(dest_simd, dest_scalar, size);
+            for (int row = 0; row < MB_HEIGHT - 1; row++) {
+                for (int col = 0; col < MB_WIDTH - 1; col++) {
+                    video.mb_row = row;
+                    video.mb_col = col;
+                    process_macroblock_scalar(&video, source, dest_scalar, 2 + odd_h, 2 + odd_v, block_size, interpolate);
+                    plm_video_process_macroblock(&video, source, dest_simd, 2 + odd_h, 2 + odd_v, block_size, interpolate);
+                }
+            }
+            if (memcmp(dest_scalar, dest_simd, size) != 0) {
+                printf("%-20s %5d MISMATCH\n", names[c], block_size);
+                failed = 1;
+                continue;
+            }
+
+            double scalar = time_case(process_macroblock_scalar, &video, source, dest_scalar, block_size, odd_h, odd_v, interpolate);
+            double simd = time_case(plm_video_process_macroblock, &video, source, dest_simd, block_size, odd_h, odd_v, interpolate);
+            printf("%-20s %5d %12.2f %12.2f %7.2fx\n", names[c], block_size, scalar, simd, scalar / simd);
+        }
+    }
+
+    free(source);
+    free(dest_scalar);
+    free(dest_simd);
+    return failed;
+}
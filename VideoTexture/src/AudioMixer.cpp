@@ -0,0 +1,168 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+#include "AudioMixer.hpp"
+
+//the implementation is compiled in VideoDecoder.cpp
+#include "pl_mpeg.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+AudioMixer::AudioMixer(std::uint32_t sampleRate)
+    : m_waiting     (false),
+    m_samplesMixed  (0),
+    m_mixBuffer     (MixSize),
+    m_outBuffer     ()
+{
+    initialize(ChannelCount, sampleRate);
+
+    //the mixer plays silence when no channel is playing, so the
+    //device latency stays the same for as long as it is running
+    play();
+}
+
+AudioMixer::~AudioMixer()
+{
+    assert(m_channels.empty());
+    stop();
+}
+
+//public
+std::shared_ptr<AudioMixer> AudioMixer::get(std::uint32_t sampleRate)
+{
+    static std::mutex mutex;
+    static std::weak_ptr<AudioMixer> instance;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto mixer = instance.lock();
+    if (!mixer)
+    {
+        mixer.reset(new AudioMixer(sampleRate));
+        instance = mixer;
+    }
+    return mixer;
+}
+
+void AudioMixer::addChannel(Channel* channel)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (std::find(m_channels.begin(), m_channels.end(), channel) == m_channels.end())
+    {
+        m_channels.push_back(channel);
+    }
+}
+
+void AudioMixer::removeChannel(Channel* channel)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_channels.erase(std::remove(m_channels.begin(), m_channels.end(), channel), m_channels.end());
+}
+
+void AudioMixer::notify()
+{
+    if (m_waiting)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_dataCondition.notify_one();
+    }
+}
+
+double AudioMixer::getLatency() const
+{
+    const auto mixed = static_cast<double>(m_samplesMixed.load()) / (getSampleRate() * ChannelCount);
+    const auto played = static_cast<double>(getPlayingOffset().asMicroseconds()) / 1000000.0;
+    return std::max(0.0, mixed - played);
+}
+
+void AudioMixer::mixSamples(const std::int16_t* src, std::size_t count, float gain, float* dst)
+{
+    plm_samples_accumulate_s16(src, static_cast<int>(count), gain, dst);
+}
+
+//private
+bool AudioMixer::onGetData(sf::SoundStream::Chunk& chunk)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    //as with a single stream, wait rather than play silence if the
+    //videos which are playing have all run dry. A channel which is
+    //dry while others have data is mixed as silence.
+    const auto starved = [&]()
+    {
+        bool playing = false;
+        for (const auto* channel : m_channels)
+        {
+            if (channel->isPlaying())
+            {
+                if (channel->getAvailable() != 0)
+                {
+                    return false;
+                }
+                playing = true;
+            }
+        }
+        return playing;
+    };
+
+    //the timeout makes sure we notice if playback is stopped in the meantime
+    if (starved())
+    {
+        m_waiting = true;
+        while (starved()
+            && getStatus() == AudioMixer::Status::Playing)
+        {
+            m_dataCondition.wait_for(lock, std::chrono::milliseconds(10));
+        }
+        m_waiting = false;
+    }
+
+    std::fill(m_mixBuffer.begin(), m_mixBuffer.end(), 0.f);
+    for (auto* channel : m_channels)
+    {
+        if (channel->isPlaying())
+        {
+            channel->mix(m_mixBuffer.data(), MixSize);
+        }
+    }
+    plm_samples_round_to_s16(m_mixBuffer.data(), m_outBuffer.data(), static_cast<int>(MixSize));
+
+    chunk.sampleCount = MixSize;
+    chunk.samples = m_outBuffer.data();
+
+    m_samplesMixed += MixSize;
+
+    return true;
+}
+
+void AudioMixer::onSeek(sf::Time)
+{
+    //the mixer is only ever played from the start
+}
@@ -0,0 +1,147 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <SFML/Audio/SoundStream.hpp>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+Mixes the audio of every playing video into a single SFML sound
+stream, so that only one audio thread and OpenAL source are used
+however many videos are playing at once.
+
+Each video supplies a Channel, which is pulled from on the audio
+thread and added to the mix at its own gain. The mixer is shared
+between all its users and closes the audio device when the last
+of them releases it.
+
+*/
+
+class AudioMixer final : public sf::SoundStream
+{
+public:
+    class Channel
+    {
+    public:
+        virtual ~Channel() = default;
+
+        //these are called on the audio thread while the mixer is locked
+        virtual bool isPlaying() const = 0;
+        virtual std::size_t getAvailable() const = 0;
+
+        //adds up to count interleaved stereo samples to dst, which is
+        //on the 16 bit scale, see plm_samples_accumulate_s16()
+        virtual void mix(float* dst, std::size_t count) = 0;
+    };
+
+    ~AudioMixer();
+
+    AudioMixer(const AudioMixer&) = delete;
+    AudioMixer& operator = (const AudioMixer&) = delete;
+
+    AudioMixer(AudioMixer&&) noexcept = delete;
+    AudioMixer& operator = (AudioMixer&&) noexcept = delete;
+
+    /*!
+    \brief Returns the shared mixer, starting it at the given sample
+    rate if it isn't already running. A running mixer keeps its rate,
+    so channels must check getSampleRate() and resample to it.
+    */
+    static std::shared_ptr<AudioMixer> get(std::uint32_t sampleRate);
+
+    /*!
+    \brief Adds a channel to the mix. The channel must be removed
+    before it is destroyed.
+    */
+    void addChannel(Channel*);
+
+    /*!
+    \brief Removes a channel from the mix. Once this returns the
+    channel is no longer used by the audio thread.
+    */
+    void removeChannel(Channel*);
+
+    /*!
+    \brief Locks the mixer, preventing any channel being mixed until
+    the lock is released. Use this to modify a channel's buffer from
+    outside the audio thread.
+    */
+    std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(m_mutex); }
+
+    /*!
+    \brief Wakes the audio thread if it's waiting for a channel to
+    receive data. Call this after writing to a channel's buffer.
+    */
+    void notify();
+
+    /*!
+    \brief Returns the time in seconds between audio being mixed and
+    being heard. Lock the mixer while reading this alongside the
+    position of a channel so that they agree.
+    */
+    double getLatency() const;
+
+    /*!
+    \brief Adds count signed 16 bit samples, multiplied by gain, to dst
+    */
+    static void mixSamples(const std::int16_t* src, std::size_t count, float gain, float* dst);
+
+private:
+    explicit AudioMixer(std::uint32_t sampleRate);
+
+    bool onGetData(sf::SoundStream::Chunk&) override;
+    void onSeek(sf::Time) override;
+
+    static constexpr std::uint32_t ChannelCount = 2;
+    static constexpr std::size_t MixSize = 1024 * ChannelCount;
+
+    std::mutex m_mutex;
+    std::vector<Channel*> m_channels;
+
+    //the audio thread sleeps on this when no playing channel has any
+    //data. Producers only take the mutex to notify if it's waiting.
+    std::condition_variable m_dataCondition;
+    std::atomic<bool> m_waiting;
+
+    //the total number of samples handed to SFML, which less the
+    //playing offset is the amount queued in the device
+    std::atomic<std::uint64_t> m_samplesMixed;
+
+    std::vector<float> m_mixBuffer;
+    std::array<std::int16_t, MixSize> m_outBuffer;
+};
@@ -0,0 +1,87 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+#include "AudioResampler.hpp"
+
+//the implementation is compiled in VideoDecoder.cpp
+#include "pl_mpeg.h"
+
+#include <cassert>
+
+AudioResampler::~AudioResampler()
+{
+    destroy();
+}
+
+bool AudioResampler::create(std::uint32_t inputRate, std::uint32_t outputRate, std::uint32_t channels)
+{
+    destroy();
+
+    if (inputRate == outputRate)
+    {
+        return false;
+    }
+
+    m_resampler = plm_resampler_create(static_cast<int>(inputRate), static_cast<int>(outputRate), static_cast<int>(channels));
+    return m_resampler != nullptr;
+}
+
+void AudioResampler::destroy()
+{
+    if (m_resampler)
+    {
+        plm_resampler_destroy(m_resampler);
+        m_resampler = nullptr;
+    }
+}
+
+void AudioResampler::reset()
+{
+    if (m_resampler)
+    {
+        plm_resampler_reset(m_resampler);
+    }
+}
+
+std::size_t AudioResampler::getOutputSize(std::size_t inputFrames) const
+{
+    assert(m_resampler);
+    return static_cast<std::size_t>(plm_resampler_get_output_size(m_resampler, static_cast<int>(inputFrames)));
+}
+
+double AudioResampler::getDelay() const
+{
+    return m_resampler ? plm_resampler_get_delay(m_resampler) : 0.0;
+}
+
+std::size_t AudioResampler::process(const float* src, std::size_t frames, float* dst)
+{
+    assert(m_resampler);
+    return static_cast<std::size_t>(plm_resampler_process(m_resampler, src, static_cast<int>(frames), dst));
+}
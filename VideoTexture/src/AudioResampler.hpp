@@ -0,0 +1,105 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct plm_resampler_t;
+typedef plm_resampler_t plm_resampler_t;
+
+/*
+Converts interleaved float audio from one sample rate to another
+with a polyphase windowed sinc filter, using SSE2, AVX2 or NEON
+where available. VideoTexture uses this to play every video at the
+same rate, so that the system mixer doesn't have to resample each
+stream again.
+
+The output lags the input by a fraction of a millisecond, returned
+by getDelay(), which needs taking into account when timing output.
+
+*/
+
+class AudioResampler final
+{
+public:
+    AudioResampler() = default;
+    ~AudioResampler();
+
+    AudioResampler(const AudioResampler&) = delete;
+    AudioResampler& operator = (const AudioResampler&) = delete;
+
+    AudioResampler(AudioResampler&&) noexcept = delete;
+    AudioResampler& operator = (AudioResampler&&) noexcept = delete;
+
+    /*!
+    \brief Sets up conversion between the given rates, discarding
+    any previous state.
+    \returns false if the rates are the same or their ratio is not
+    supported, in which case the resampler is left inactive.
+    */
+    bool create(std::uint32_t inputRate, std::uint32_t outputRate, std::uint32_t channels);
+
+    /*!
+    \brief Releases the filter, leaving the resampler inactive
+    */
+    void destroy();
+
+    /*!
+    \brief Returns true if create() succeeded
+    */
+    bool isActive() const { return m_resampler != nullptr; }
+
+    /*!
+    \brief Discards the samples held in the filter, eg after seeking
+    */
+    void reset();
+
+    /*!
+    \brief Returns the most frames process() may write for the given
+    number of input frames
+    */
+    std::size_t getOutputSize(std::size_t inputFrames) const;
+
+    /*!
+    \brief Returns the time in seconds by which the output lags the input
+    */
+    double getDelay() const;
+
+    /*!
+    \brief Resamples frames of interleaved audio from src into dst,
+    which must have room for getOutputSize(frames) frames.
+    \returns The number of frames written
+    */
+    std::size_t process(const float* src, std::size_t frames, float* dst);
+
+private:
+    plm_resampler_t* m_resampler = nullptr;
+};
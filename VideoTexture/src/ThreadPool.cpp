@@ -0,0 +1,143 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+
+#include "ThreadPool.hpp"
+
+#include <cassert>
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+void ThreadPool::start(std::uint32_t workerCount)
+{
+    assert(m_workers.empty());
+
+    //the generation carries on from any previous start(), so new
+    //workers begin from the current one rather than picking up
+    //the last batch run before the pool was stopped
+    std::uint32_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = false;
+        m_finishedWorkers = 0;
+        generation = m_generation;
+    }
+
+    for (auto i = 0u; i < workerCount; ++i)
+    {
+        m_workers.emplace_back(&ThreadPool::threadFunc, this, generation);
+    }
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_startCondition.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+    m_workers.clear();
+}
+
+void ThreadPool::run(std::uint32_t jobCount, const Job& job)
+{
+    if (m_workers.empty() || jobCount < 2)
+    {
+        for (auto i = 0u; i < jobCount; ++i)
+        {
+            job(i);
+        }
+        return;
+    }
+
+    //one batch at a time - anyone else sharing the pool waits here
+    std::lock_guard<std::mutex> runLock(m_runMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &job;
+        m_jobCount = jobCount;
+        m_nextJob = 0;
+        m_finishedWorkers = 0;
+        m_generation++;
+    }
+    m_startCondition.notify_all();
+
+    runJobs();
+
+    //every worker has to check in before returning, else one
+    //which was slow to wake might start on the next batch
+    //with this batch's count
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finishCondition.wait(lock, [&]() { return m_finishedWorkers == m_workers.size(); });
+    m_job = nullptr;
+}
+
+void ThreadPool::threadFunc(std::uint32_t generation)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_startCondition.wait(lock, [&]() { return m_quit || m_generation != generation; });
+
+            if (m_quit)
+            {
+                return;
+            }
+            generation = m_generation;
+        }
+
+        runJobs();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finishedWorkers++;
+        }
+        m_finishCondition.notify_one();
+    }
+}
+
+void ThreadPool::runJobs()
+{
+    //jobs tend to cost about the same, but pulling them
+    //from a shared counter keeps everyone busy regardless
+    for (auto job = m_nextJob++; job < m_jobCount; job = m_nextJob++)
+    {
+        (*m_job)(job);
+    }
+}
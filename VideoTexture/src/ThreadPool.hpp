@@ -0,0 +1,104 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+A fixed set of worker threads which share out a number of jobs
+identified by index, such as the slices of a picture or the stripes
+of a frame being converted. The thread calling run() takes part too,
+and run() returns once every job is done.
+
+A pool may be shared, for example between several decoders or by
+a batch of conversions - concurrent calls to run() are queued.
+
+*/
+
+class ThreadPool final
+{
+public:
+    using Job = std::function<void(std::uint32_t)>;
+
+    ThreadPool() = default;
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    ThreadPool(ThreadPool&&) noexcept = delete;
+    ThreadPool& operator = (ThreadPool&&) noexcept = delete;
+
+    /*!
+    \brief Starts the given number of worker threads, in addition
+    to the thread which calls run(). The pool must not be running.
+    */
+    void start(std::uint32_t workerCount);
+
+    /*!
+    \brief Stops and joins all the worker threads
+    */
+    void stop();
+
+    /*!
+    \brief Returns the number of threads taking part in run(),
+    including the calling thread
+    */
+    std::uint32_t getThreadCount() const { return static_cast<std::uint32_t>(m_workers.size()) + 1; }
+
+    /*!
+    \brief Calls job once for each index from 0 to jobCount - 1,
+    spread across the pool, and waits for them all to finish.
+    */
+    void run(std::uint32_t jobCount, const Job& job);
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_runMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_startCondition;
+    std::condition_variable m_finishCondition;
+
+    const Job* m_job = nullptr;
+    std::uint32_t m_jobCount = 0;
+    std::atomic<std::uint32_t> m_nextJob{ 0 };
+    std::uint32_t m_generation = 0;
+    std::uint32_t m_finishedWorkers = 0;
+    bool m_quit = false;
+
+    void threadFunc(std::uint32_t generation);
+    void runJobs();
+};
@@ -0,0 +1,543 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+
+#include "VideoDecoder.hpp"
+
+#define PL_MPEG_IMPLEMENTATION
+#include "pl_mpeg.h"
+
+#include <sys/stat.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+static_assert(VideoDecoder::AudioSamplesPerFrame == PLM_AUDIO_SAMPLES_PER_FRAME, "Audio frame size doesn't match pl_mpeg");
+
+namespace
+{
+    //seek index files are a header followed by an array of entries,
+    //written in native byte order - they're a cache, not an exchange
+    //format, so a mismatch just causes the index to be rebuilt.
+    //The size and modification time of the video are stored so that
+    //the index is rebuilt if the video is replaced. The start time
+    //and duration are stored too, so the file needn't be probed.
+    static constexpr char SeekIndexMagic[4] = { 'V', 'T', 'I', 'X' };
+    static constexpr std::uint32_t SeekIndexVersion = 2;
+    const std::string SeekIndexExtension(".vtidx");
+
+    struct SeekIndexHeader final
+    {
+        char magic[4] = {};
+        std::uint32_t version = 0;
+        std::uint64_t fileSize = 0;
+        std::int64_t modifiedTime = 0;
+        double startTime = 0.0;
+        double duration = 0.0;
+        std::uint64_t entryCount = 0;
+    };
+
+    struct SeekIndexEntry final
+    {
+        double pts = 0.0;
+        std::uint64_t position = 0;
+    };
+
+    bool getFileStats(const std::string& path, std::uint64_t& size, std::int64_t& modifiedTime)
+    {
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(path.c_str(), &st) != 0)
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+#endif
+        {
+            return false;
+        }
+        size = static_cast<std::uint64_t>(st.st_size);
+        modifiedTime = static_cast<std::int64_t>(st.st_mtime);
+        return true;
+    }
+
+    //conversion stripes are sized so that the rows each one reads
+    //and writes fit comfortably in a typical L2 cache
+    static constexpr std::size_t ConversionStripeBytes = 128 * 1024;
+
+    std::uint32_t getStripeRows(std::uint32_t width)
+    {
+        //each pair of rows reads two rows of Y and a half width row
+        //each of Cb and Cr, and writes two rows of RGBA
+        const std::size_t pairBytes = width * 2 + width + width * 8;
+        return std::max(std::size_t(1), ConversionStripeBytes / pairBytes) * 2;
+    }
+
+    void convertRows(const std::array<VideoDecoder::Plane, 3>& planes, std::uint32_t width,
+        std::uint32_t firstRow, std::uint32_t rowCount, std::uint8_t* dst)
+    {
+        //firstRow is always even, so it starts on a row of chroma
+        assert(firstRow % 2 == 0);
+        const auto chromaRow = firstRow / 2;
+
+        plm_planes_to_pixels(planes[0].data + firstRow * planes[0].stride, planes[0].stride,
+            planes[1].data + chromaRow * planes[1].stride, planes[2].data + chromaRow * planes[2].stride, planes[1].stride,
+            width, rowCount, dst + firstRow * width * 4, width * 4, PLM_PIXEL_FORMAT_RGBA, PLM_COLOR_RANGE_LIMITED);
+    }
+}
+
+
+//C senor.
+void Detail::videoCallback(plm_t*, plm_frame_t* frame, void* user)
+{
+    auto* decoder = static_cast<VideoDecoder*>(user);
+    if (decoder->m_frameCallback)
+    {
+        decoder->setFrame(frame);
+        decoder->m_frameCallback(decoder->m_frame);
+    }
+}
+
+void Detail::audioCallback(plm_t*, plm_samples_t* samples, void* user)
+{
+    auto* decoder = static_cast<VideoDecoder*>(user);
+    if (decoder->m_audioCallback)
+    {
+        decoder->m_audioCallback(samples->interleaved, samples->time);
+    }
+}
+
+void Detail::sliceCallback(plm_video_t* video, int count, void* user)
+{
+    auto* pool = static_cast<ThreadPool*>(user);
+    pool->run(static_cast<std::uint32_t>(count), [video](std::uint32_t slice)
+        {
+            plm_video_decode_slice_job(video, static_cast<int>(slice));
+        });
+}
+
+VideoDecoder::VideoDecoder()
+    : m_plm             (nullptr),
+    m_looped            (false),
+    m_sliceThreadCount  (0),
+    m_seekIndexEnabled  (false),
+    m_duration          (0.f)
+{
+
+}
+
+VideoDecoder::~VideoDecoder()
+{
+    close();
+}
+
+bool VideoDecoder::open(const std::string& path)
+{
+    close();
+
+    //load the file - this is memory mapped where the platform
+    //supports it, else it's read through the usual file buffer
+    m_plm = plm_create_with_mapped_file(path.c_str());
+
+    if (!m_plm)
+    {
+        std::cout << "Failed creating video player instance (incompatible file or incorrect file name?)" << path << std::endl;
+        return false;
+    }
+
+    if (plm_get_width(m_plm) == 0
+        || plm_get_height(m_plm) == 0
+        || plm_get_framerate(m_plm) == 0)
+    {
+        std::cout << path << ": invalid file properties" << std::endl;
+        plm_destroy(m_plm);
+        m_plm = nullptr;
+
+        return false;
+    }
+
+    plm_set_video_decode_callback(m_plm, Detail::videoCallback, this);
+    plm_set_audio_decode_callback(m_plm, Detail::audioCallback, this);
+    plm_set_loop(m_plm, m_looped ? 1 : 0);
+
+    if (m_seekIndexEnabled && !loadSeekIndex(path))
+    {
+        if (plm_build_seek_index(m_plm))
+        {
+            saveSeekIndex(path);
+        }
+        else
+        {
+            std::cout << path << ": no keyframes found, seeking without an index" << std::endl;
+        }
+    }
+
+    //probing for the duration reads the end of the file, so do it
+    //once here rather than every time getDuration() is called
+    plm_demux_probe_t probe = {};
+    plm_get_probe(m_plm, &probe);
+    m_duration = static_cast<float>(probe.duration);
+
+    if (m_sliceThreadCount > 1)
+    {
+        m_slicePool.start(m_sliceThreadCount - 1);
+        plm_set_video_slice_callback(m_plm, Detail::sliceCallback, &m_slicePool);
+    }
+
+    return true;
+}
+
+void VideoDecoder::close()
+{
+    m_slicePool.stop();
+
+    if (m_plm)
+    {
+        plm_destroy(m_plm);
+        m_plm = nullptr;
+    }
+    m_duration = 0.f;
+}
+
+void VideoDecoder::decode(float seconds)
+{
+    if (m_plm)
+    {
+        plm_decode(m_plm, seconds);
+    }
+}
+
+bool VideoDecoder::decodeFrame(Frame& frame)
+{
+    if (m_plm)
+    {
+        const auto* decoded = plm_decode_video(m_plm);
+        if (decoded)
+        {
+            setFrame(decoded);
+            frame = m_frame;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VideoDecoder::seek(float position, bool exact)
+{
+    return m_plm
+        && plm_seek(m_plm, position, exact ? TRUE : FALSE) != 0;
+}
+
+bool VideoDecoder::hasEnded() const
+{
+    return !m_plm
+        || plm_has_ended(m_plm) != 0;
+}
+
+float VideoDecoder::getTime() const
+{
+    return m_plm ? static_cast<float>(plm_get_time(m_plm)) : 0.f;
+}
+
+std::uint32_t VideoDecoder::getWidth() const
+{
+    return m_plm ? static_cast<std::uint32_t>(plm_get_width(m_plm)) : 0;
+}
+
+std::uint32_t VideoDecoder::getHeight() const
+{
+    return m_plm ? static_cast<std::uint32_t>(plm_get_height(m_plm)) : 0;
+}
+
+float VideoDecoder::getFrameRate() const
+{
+    return m_plm ? static_cast<float>(plm_get_framerate(m_plm)) : 0.f;
+}
+
+bool VideoDecoder::hasAudio() const
+{
+    return m_plm
+        && plm_get_num_audio_streams(m_plm) > 0;
+}
+
+std::uint32_t VideoDecoder::getSampleRate() const
+{
+    return hasAudio() ? static_cast<std::uint32_t>(plm_get_samplerate(m_plm)) : 0;
+}
+
+void VideoDecoder::setAudioLeadTime(float seconds)
+{
+    if (m_plm)
+    {
+        plm_set_audio_lead_time(m_plm, seconds);
+    }
+}
+
+void VideoDecoder::setSkipBFrames(bool skip)
+{
+    if (m_plm)
+    {
+        plm_set_video_skip_b_frames(m_plm, skip ? TRUE : FALSE);
+    }
+}
+
+void VideoDecoder::setLooped(bool looped)
+{
+    m_looped = looped;
+
+    if (m_plm)
+    {
+        plm_set_loop(m_plm, looped ? 1 : 0);
+    }
+}
+
+void VideoDecoder::convertToRGBA(const std::array<Plane, 3>& planes, std::uint32_t width, std::uint32_t height, std::uint8_t* dst)
+{
+    //the chroma planes share a stride as they're always the same size
+    assert(planes[1].stride == planes[2].stride);
+
+    convertRows(planes, width, 0, height, dst);
+}
+
+void VideoDecoder::convertToRGBA(const std::array<Plane, 3>& planes, std::uint32_t width, std::uint32_t height, std::uint8_t* dst, ThreadPool& pool)
+{
+    assert(planes[1].stride == planes[2].stride);
+
+    //use smaller stripes if needed so that every thread gets one
+    auto stripeRows = getStripeRows(width);
+    const auto threadCount = pool.getThreadCount();
+    if (height / stripeRows < threadCount)
+    {
+        stripeRows = std::max(2u, ((height / threadCount) + 1) & ~1u);
+    }
+
+    const auto stripeCount = (height + stripeRows - 1) / stripeRows;
+    pool.run(stripeCount, [&](std::uint32_t stripe)
+        {
+            const auto firstRow = stripe * stripeRows;
+            convertRows(planes, width, firstRow, std::min(stripeRows, height - firstRow), dst);
+        });
+}
+
+void VideoDecoder::convertToRGBA(const std::array<Plane, 3>& planes, std::uint32_t width, std::uint32_t height, std::uint8_t* dst, std::uint32_t threadCount)
+{
+    if (threadCount < 2)
+    {
+        convertToRGBA(planes, width, height, dst);
+        return;
+    }
+
+    //held for the whole conversion so the pool
+    //can't be restarted by another caller meanwhile
+    static std::mutex mutex;
+    static ThreadPool pool;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pool.getThreadCount() != threadCount)
+    {
+        pool.stop();
+        pool.start(threadCount - 1);
+    }
+    convertToRGBA(planes, width, height, dst, pool);
+}
+
+void VideoDecoder::convertSamples(const float* src, std::int16_t* dst, std::size_t count, DitherState* dither)
+{
+    plm_samples_to_s16(src, dst, static_cast<int>(count), dither ? dither->data() : nullptr);
+}
+
+//private
+void VideoDecoder::setFrame(const plm_frame_t* frame)
+{
+    const std::array<const plm_plane_t*, 3> planes = { &frame->y, &frame->cb, &frame->cr };
+    for (auto i = 0u; i < planes.size(); ++i)
+    {
+        //planes decoded by pl_mpeg are tightly packed
+        m_frame.planes[i].data = planes[i]->data;
+        m_frame.planes[i].width = planes[i]->width;
+        m_frame.planes[i].height = planes[i]->height;
+        m_frame.planes[i].stride = planes[i]->width;
+    }
+    m_frame.time = frame->time;
+}
+
+std::string VideoDecoder::getSeekIndexPath(const std::string& path) const
+{
+    if (m_seekIndexDirectory.empty())
+    {
+        return path + SeekIndexExtension;
+    }
+
+    //videos with the same name may live in different directories
+    //so tag the file name with a hash (FNV-1a) of the full path
+    std::uint32_t hash = 2166136261u;
+    for (auto c : path)
+    {
+        hash = (hash ^ static_cast<std::uint8_t>(c)) * 16777619u;
+    }
+
+    auto name = path.substr(path.find_last_of("/\\") + 1);
+
+    std::string hex(8, '0');
+    for (auto i = 0u; i < hex.size(); ++i)
+    {
+        hex[i] = "0123456789abcdef"[(hash >> (28 - i * 4)) & 0xf];
+    }
+
+    auto directory = m_seekIndexDirectory;
+    if (directory.back() != '/' && directory.back() != '\\')
+    {
+        directory += '/';
+    }
+    return directory + name + "." + hex + SeekIndexExtension;
+}
+
+bool VideoDecoder::loadSeekIndex(const std::string& path)
+{
+    std::uint64_t fileSize = 0;
+    std::int64_t modifiedTime = 0;
+    if (!getFileStats(path, fileSize, modifiedTime))
+    {
+        return false;
+    }
+
+    std::ifstream file(getSeekIndexPath(path), std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    //the entry count has to match the length of the file, so that a
+    //corrupt header can't make us allocate more than was written
+    const auto length = static_cast<std::streamoff>(file.tellg());
+    if (length < static_cast<std::streamoff>(sizeof(SeekIndexHeader))
+        || (length - sizeof(SeekIndexHeader)) % sizeof(SeekIndexEntry) != 0)
+    {
+        return false;
+    }
+    const auto entryCount = static_cast<std::uint64_t>((length - sizeof(SeekIndexHeader)) / sizeof(SeekIndexEntry));
+    file.seekg(0);
+
+    SeekIndexHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, SeekIndexMagic, sizeof(SeekIndexMagic)) != 0
+        || header.version != SeekIndexVersion
+        || header.fileSize != fileSize
+        || header.modifiedTime != modifiedTime
+        || header.entryCount == 0
+        || header.entryCount != entryCount)
+    {
+        return false;
+    }
+
+    std::vector<SeekIndexEntry> entries(static_cast<std::size_t>(header.entryCount));
+    if (!file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(SeekIndexEntry)))
+    {
+        return false;
+    }
+
+    std::vector<plm_demux_seek_index_entry_t> index(entries.size());
+    for (auto i = 0u; i < entries.size(); ++i)
+    {
+        index[i].pts = entries[i].pts;
+        index[i].pos = static_cast<std::size_t>(entries[i].position);
+    }
+    if (!plm_set_seek_index(m_plm, index.data(), index.size()))
+    {
+        return false;
+    }
+
+    plm_demux_probe_t probe = {};
+    probe.start_time = header.startTime;
+    probe.duration = header.duration;
+    return plm_set_probe(m_plm, &probe) != 0;
+}
+
+void VideoDecoder::saveSeekIndex(const std::string& path)
+{
+    SeekIndexHeader header;
+    if (!getFileStats(path, header.fileSize, header.modifiedTime))
+    {
+        return;
+    }
+
+    plm_demux_probe_t probe;
+    if (!plm_get_probe(m_plm, &probe))
+    {
+        return;
+    }
+    header.startTime = probe.start_time;
+    header.duration = probe.duration;
+
+    std::size_t count = 0;
+    const auto* index = plm_get_seek_index(m_plm, &count);
+
+    std::vector<SeekIndexEntry> entries(count);
+    for (auto i = 0u; i < count; ++i)
+    {
+        entries[i].pts = index[i].pts;
+        entries[i].position = index[i].pos;
+    }
+
+    std::memcpy(header.magic, SeekIndexMagic, sizeof(SeekIndexMagic));
+    header.version = SeekIndexVersion;
+    header.entryCount = count;
+
+    //write to a temporary file and rename it over the old index, so
+    //that a crash or another loader never sees a partly written file
+    const auto indexPath = getSeekIndexPath(path);
+    const auto tempPath = indexPath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary);
+        if (!file.is_open()
+            || !file.write(reinterpret_cast<const char*>(&header), sizeof(header))
+            || !file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(SeekIndexEntry))
+            || !file.flush())
+        {
+            std::cout << "Unable to write seek index " << indexPath << std::endl;
+            file.close();
+            std::remove(tempPath.c_str());
+            return;
+        }
+    }
+
+    //rename() won't replace an existing file on Windows
+    if (std::rename(tempPath.c_str(), indexPath.c_str()) != 0)
+    {
+        std::remove(indexPath.c_str());
+        if (std::rename(tempPath.c_str(), indexPath.c_str()) != 0)
+        {
+            std::cout << "Unable to write seek index " << indexPath << std::endl;
+            std::remove(tempPath.c_str());
+        }
+    }
+}
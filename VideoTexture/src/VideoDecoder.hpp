@@ -0,0 +1,359 @@
+/*-----------------------------------------------------------------------
+
+Matt Marchant 2024
+http://trederia.blogspot.com
+
+Video Texture for SFML - Zlib license.
+
+This software is provided 'as-is', without any express or
+implied warranty.In no event will the authors be held
+liable for any damages arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute
+it freely, subject to the following restrictions :
+
+1. The origin of this software must not be misrepresented;
+you must not claim that you wrote the original software.
+If you use this software in a product, an acknowledgment
+in the product documentation would be appreciated but
+is not required.
+
+2. Altered source versions must be plainly marked as such,
+and must not be misrepresented as being the original software.
+
+3. This notice may not be removed or altered from any
+source distribution.
+
+-----------------------------------------------------------------------*/
+
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <string>
+#include <array>
+#include <cstdint>
+#include <functional>
+
+struct plm_t;
+typedef plm_t plm_t;
+
+struct plm_frame_t;
+typedef plm_frame_t plm_frame_t;
+
+struct plm_samples_t;
+typedef plm_samples_t plm_samples_t;
+
+struct plm_video_t;
+typedef plm_video_t plm_video_t;
+
+
+namespace Detail
+{
+    void videoCallback(plm_t*, plm_frame_t*, void*);
+    void audioCallback(plm_t*, plm_samples_t*, void*);
+    void sliceCallback(plm_video_t*, int, void*);
+}
+
+/*
+Decodes MPEG1 video and audio using pl_mpeg without any dependency
+on SFML or OpenGL, so that it can be used on machines without a
+display, for example to generate thumbnails. VideoTexture uses this
+to decode the frames it uploads to the GPU.
+
+Usage:
+Decoded frames are exposed as views of their Y, Cb and Cr planes,
+which are owned by the decoder. Either set a frame callback and
+call decode() with the elapsed time, which decodes everything up to
+that time as VideoTexture::update() does, or pull frames one at a
+time with decodeFrame().
+
+The decoder is not thread safe - calls to a single instance must
+be serialised by the caller.
+
+*/
+
+class VideoDecoder final
+{
+public:
+
+    /*!
+    \brief A single plane of a decoded frame. The plane is stored
+    row by row, each row being stride bytes apart, and is padded to
+    a whole number of macroblocks so may be larger than the video.
+    */
+    struct Plane final
+    {
+        const std::uint8_t* data = nullptr;
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        std::uint32_t stride = 0;
+    };
+
+    /*!
+    \brief A decoded frame in YCbCr 4:2:0 format. The chroma planes
+    are half the width and height of the luma plane. The plane data
+    is only valid until the decoder is next used.
+    */
+    struct Frame final
+    {
+        std::array<Plane, 3> planes; //Y, Cb, Cr
+        double time = 0.0; //presentation time in seconds
+    };
+
+    /*!
+    \brief Called for every decoded frame
+    */
+    using FrameCallback = std::function<void(const Frame&)>;
+
+    /*!
+    \brief Called for every decoded block of audio, with
+    AudioSamplesPerFrame interleaved stereo samples in the
+    range -1 to 1, and the presentation time of the first.
+    */
+    using AudioCallback = std::function<void(const float* samples, double time)>;
+
+    static constexpr std::uint32_t AudioChannelCount = 2;
+    static constexpr std::uint32_t AudioSamplesPerFrame = 1152;
+
+    VideoDecoder();
+    ~VideoDecoder();
+
+    VideoDecoder(const VideoDecoder&) = delete;
+    VideoDecoder& operator = (const VideoDecoder&) = delete;
+
+    VideoDecoder(VideoDecoder&&) noexcept = delete;
+    VideoDecoder& operator = (VideoDecoder&&) noexcept = delete;
+
+
+    /*!
+    \brief Attempts to open an MPEG1 file, closing any file
+    which is already open.
+    On Linux and other POSIX systems the file is memory mapped
+    rather than read into an intermediate buffer.
+    \returns true on success or false if the file doesn't
+    exist or is not a valid MPEG1 file.
+    */
+    bool open(const std::string& path);
+
+    /*!
+    \brief Closes the open file, if there is one
+    */
+    void close();
+
+    /*!
+    \brief Returns true if a file is open
+    */
+    bool isOpen() const { return m_plm != nullptr; }
+
+    /*!
+    \brief Sets the function called with each frame decoded by
+    decode(). Pass an empty function to ignore video.
+    */
+    void setFrameCallback(const FrameCallback& callback) { m_frameCallback = callback; }
+
+    /*!
+    \brief Sets the function called with the audio decoded by
+    decode(). Pass an empty function to ignore audio.
+    */
+    void setAudioCallback(const AudioCallback& callback) { m_audioCallback = callback; }
+
+    /*!
+    \brief Advances the decoder by the given number of seconds,
+    invoking the frame and audio callbacks for everything decoded.
+    */
+    void decode(float seconds);
+
+    /*!
+    \brief Decodes the next video frame, ignoring any audio.
+    \param frame - Filled with the decoded frame on success
+    \returns false if there are no more frames
+    */
+    bool decodeFrame(Frame& frame);
+
+    /*!
+    \brief Seeks to the given time in the file.
+    \param position - Time in seconds
+    \param exact - If true decoding continues from the keyframe
+    before position up to the frame at position, else it starts
+    from the nearest keyframe, which is much faster.
+    \returns false if seeking failed
+    */
+    bool seek(float position, bool exact = false);
+
+    /*!
+    \brief Returns true if the end of the file has been reached
+    */
+    bool hasEnded() const;
+
+    /*!
+    \brief Returns the current decoding time in seconds
+    */
+    float getTime() const;
+
+    /*!
+    \brief Returns the duration of the open file in seconds
+    */
+    float getDuration() const { return m_duration; }
+
+    /*!
+    \brief Returns the display width of the video
+    */
+    std::uint32_t getWidth() const;
+
+    /*!
+    \brief Returns the display height of the video
+    */
+    std::uint32_t getHeight() const;
+
+    /*!
+    \brief Returns the frame rate of the video
+    */
+    float getFrameRate() const;
+
+    /*!
+    \brief Returns true if the open file has an audio stream
+    */
+    bool hasAudio() const;
+
+    /*!
+    \brief Returns the sample rate of the audio, or 0 if there is none
+    */
+    std::uint32_t getSampleRate() const;
+
+    /*!
+    \brief Sets how far, in seconds, audio is decoded ahead of the
+    video by decode(). Defaults to 0.
+    */
+    void setAudioLeadTime(float seconds);
+
+    /*!
+    \brief Sets whether B-frames are skipped rather than decoded.
+    Skipped frames are reported as a repeat of the previous frame,
+    which makes catching up cheaper when frames won't be seen.
+    */
+    void setSkipBFrames(bool skip);
+
+    /*!
+    \brief Set looped playback enabled
+    */
+    void setLooped(bool looped);
+
+    /*!
+    \brief Gets whether or not playback is currently set to looped
+    */
+    bool getLooped() const { return m_looped; }
+
+    /*!
+    \brief Sets the number of threads used to decode the slices of
+    each video picture, including the thread calling the decoder.
+    This takes effect the next time open() is called.
+    See VideoTexture::setSliceThreadCount()
+    */
+    void setSliceThreadCount(std::uint32_t count) { m_sliceThreadCount = count; }
+
+    /*!
+    \brief Returns the number of threads used to decode video slices
+    */
+    std::uint32_t getSliceThreadCount() const { return m_sliceThreadCount; }
+
+    /*!
+    \brief Enables or disables building a seek index when a file
+    is opened. See VideoTexture::setSeekIndexEnabled()
+    */
+    void setSeekIndexEnabled(bool enabled) { m_seekIndexEnabled = enabled; }
+
+    /*!
+    \brief Returns whether or not a seek index is built on open
+    */
+    bool getSeekIndexEnabled() const { return m_seekIndexEnabled; }
+
+    /*!
+    \brief Sets the directory in which seek index files are stored.
+    See VideoTexture::setSeekIndexDirectory()
+    */
+    void setSeekIndexDirectory(const std::string& directory) { m_seekIndexDirectory = directory; }
+
+    /*!
+    \brief Returns the directory in which seek index files are stored
+    */
+    const std::string& getSeekIndexDirectory() const { return m_seekIndexDirectory; }
+
+    /*!
+    \brief Converts the planes of a decoded frame to RGBA pixels on
+    the CPU, using SIMD where it's supported. This can be used where
+    a shader isn't available to do the conversion on the GPU.
+    \param planes - The Y, Cb and Cr planes of a frame
+    \param width - The width of the video, which may be smaller than
+    the planes
+    \param height - The height of the video
+    \param dst - Buffer of at least width * height * 4 bytes. Alpha is
+    not written, so should be set once when the buffer is created.
+    */
+    static void convertToRGBA(const std::array<Plane, 3>& planes, std::uint32_t width, std::uint32_t height, std::uint8_t* dst);
+
+    /*!
+    \brief Converts the planes of a frame to RGBA as above, splitting
+    the rows into stripes shared between the threads of the given pool.
+    Stripes are sized so that the rows they read and write stay in the
+    cache while they're being converted.
+    */
+    static void convertToRGBA(const std::array<Plane, 3>& planes, std::uint32_t width, std::uint32_t height, std::uint8_t* dst, ThreadPool& pool);
+
+    /*!
+    \brief Converts the planes of a frame to RGBA as above using the
+    given number of threads, including the calling thread. The threads
+    belong to a pool shared by all calls to this function, which is
+    restarted only when the thread count changes.
+    */
+    static void convertToRGBA(const std::array<Plane, 3>& planes, std::uint32_t width, std::uint32_t height, std::uint8_t* dst, std::uint32_t threadCount);
+
+    /*!
+    \brief State for dithering converted audio samples. Each value
+    must be seeded with a non-zero number.
+    */
+    using DitherState = std::array<std::uint32_t, 4>;
+
+    /*!
+    \brief Converts decoded audio samples to signed 16 bit, using SIMD
+    where it's supported. Samples outside the range -1 to 1 are clamped
+    rather than wrapping around.
+    \param src - Samples as passed to the audio callback
+    \param dst - Buffer of at least count samples
+    \param count - Number of samples to convert
+    \param dither - If not null, triangular dither of up to one step is
+    added to the samples, which masks quantisation distortion in quiet
+    passages at the cost of a very low level of noise. The state is
+    updated so that it can be passed to the next call.
+    */
+    static void convertSamples(const float* src, std::int16_t* dst, std::size_t count, DitherState* dither = nullptr);
+
+private:
+
+    plm_t* m_plm;
+    bool m_looped;
+    std::uint32_t m_sliceThreadCount;
+    bool m_seekIndexEnabled;
+    std::string m_seekIndexDirectory;
+    float m_duration;
+
+    FrameCallback m_frameCallback;
+    AudioCallback m_audioCallback;
+
+    //the frame passed to the callback, pointing
+    //into buffers owned by m_plm
+    Frame m_frame;
+    void setFrame(const plm_frame_t*);
+
+    std::string getSeekIndexPath(const std::string&) const;
+    bool loadSeekIndex(const std::string&);
+    void saveSeekIndex(const std::string&);
+
+    //worker pool for slice decoding
+    ThreadPool m_slicePool;
+
+    //because function pointers
+    friend void Detail::videoCallback(plm_t*, plm_frame_t*, void*);
+    friend void Detail::audioCallback(plm_t*, plm_samples_t*, void*);
+};
@@ -29,14 +29,16 @@ source distribution.
 
 #include "VideoTexture.hpp"
 
-#define PL_MPEG_IMPLEMENTATION
-#include "pl_mpeg.h"
-
 #include <SFML/OpenGL.hpp>
+#include <SFML/Window/Context.hpp>
 
 #include <string>
 #include <iostream>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <chrono>
 #include <thread>
 
@@ -66,33 +68,189 @@ void main()
     gl_FragColor = vec4(y, cb, cr, 1.0) * rec601;
 })";
 
-    //this is always 2, according to PLM.
-    static constexpr std::uint32_t ChannelCount = 2;
-    static constexpr std::uint32_t AudioBufferSize = PLM_AUDIO_SAMPLES_PER_FRAME * ChannelCount;
-}
+    static constexpr std::uint32_t ChannelCount = VideoDecoder::AudioChannelCount;
+    static constexpr std::uint32_t AudioBufferSize = VideoDecoder::AudioSamplesPerFrame * ChannelCount;
+
+    //SFML only guarantees the OpenGL 1.1 headers, so the few newer
+    //functions used for uploading frames are loaded at run time
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+#ifndef GL_NUM_EXTENSIONS
+#define GL_NUM_EXTENSIONS 0x821D
+#endif
+
+    struct GLFunctions final
+    {
+        using TexStorage2D = void(APIENTRY*)(GLenum, GLsizei, GLenum, GLsizei, GLsizei);
+        using GenBuffers = void(APIENTRY*)(GLsizei, GLuint*);
+        using DeleteBuffers = void(APIENTRY*)(GLsizei, const GLuint*);
+        using BindBuffer = void(APIENTRY*)(GLenum, GLuint);
+        using BufferData = void(APIENTRY*)(GLenum, std::ptrdiff_t, const void*, GLenum);
+        using MapBuffer = void*(APIENTRY*)(GLenum, GLenum);
+        using UnmapBuffer = GLboolean(APIENTRY*)(GLenum);
+        using GetStringi = const GLubyte*(APIENTRY*)(GLenum, GLuint);
+
+        TexStorage2D texStorage2D = nullptr;
+        GenBuffers genBuffers = nullptr;
+        DeleteBuffers deleteBuffers = nullptr;
+        BindBuffer bindBuffer = nullptr;
+        BufferData bufferData = nullptr;
+        MapBuffer mapBuffer = nullptr;
+        UnmapBuffer unmapBuffer = nullptr;
+
+        bool textureStorage = false;
+        bool pixelBuffers = false;
+
+        bool hasTextureStorage() const
+        {
+            return textureStorage && texStorage2D;
+        }
 
+        bool hasPixelBuffers() const
+        {
+            return pixelBuffers
+                && genBuffers && deleteBuffers && bindBuffer
+                && bufferData && mapBuffer && unmapBuffer;
+        }
+    };
 
-//C senor.
-void Detail::videoCallback(plm_t* mpg, plm_frame_t* frame, void* user)
-{
-    auto* videoPlayer = static_cast<VideoTexture*>(user);
-    videoPlayer->updateTexture(videoPlayer->m_y, &frame->y);
-    videoPlayer->updateTexture(videoPlayer->m_cb, &frame->cb);
-    videoPlayer->updateTexture(videoPlayer->m_cr, &frame->cr);
-}
+    //SFML's contexts share their objects, so the functions loaded
+    //for the most recently opened file are used by every VideoTexture
+    GLFunctions glFunctions;
 
-void Detail::audioCallback(plm_t*, plm_samples_t* samples, void* user)
-{
-    auto* videoPlayer = static_cast<VideoTexture*>(user);
-    videoPlayer->m_audioStream.pushData(samples->interleaved);   
+    bool hasExtension(const char* name, GLint majorVersion, const GLFunctions::GetStringi getStringi)
+    {
+        //core profiles only list extensions one at a time
+        if (majorVersion >= 3
+            && getStringi)
+        {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (auto i = 0; i < count; ++i)
+            {
+                const auto* extension = reinterpret_cast<const char*>(getStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+                if (extension && std::strcmp(extension, name) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const auto* extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+        if (!extensions)
+        {
+            return false;
+        }
+
+        //match whole names only, the list is space separated
+        const auto length = std::strlen(name);
+        for (const auto* found = std::strstr(extensions, name); found; found = std::strstr(found + length, name))
+        {
+            if ((found == extensions || found[-1] == ' ')
+                && (found[length] == ' ' || found[length] == '\0'))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //requires an active context. A non-null pointer from getFunction()
+    //doesn't mean the function is supported - GLX, for one, returns an
+    //address for any name - so support is decided by the version and
+    //extensions of the context
+    const GLFunctions& loadGLFunctions()
+    {
+        GLFunctions f;
+        f.texStorage2D = reinterpret_cast<GLFunctions::TexStorage2D>(sf::Context::getFunction("glTexStorage2D"));
+        f.genBuffers = reinterpret_cast<GLFunctions::GenBuffers>(sf::Context::getFunction("glGenBuffers"));
+        f.deleteBuffers = reinterpret_cast<GLFunctions::DeleteBuffers>(sf::Context::getFunction("glDeleteBuffers"));
+        f.bindBuffer = reinterpret_cast<GLFunctions::BindBuffer>(sf::Context::getFunction("glBindBuffer"));
+        f.bufferData = reinterpret_cast<GLFunctions::BufferData>(sf::Context::getFunction("glBufferData"));
+        f.mapBuffer = reinterpret_cast<GLFunctions::MapBuffer>(sf::Context::getFunction("glMapBuffer"));
+        f.unmapBuffer = reinterpret_cast<GLFunctions::UnmapBuffer>(sf::Context::getFunction("glUnmapBuffer"));
+
+        GLint major = 0;
+        GLint minor = 0;
+        const auto* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        if (version)
+        {
+            std::sscanf(version, "%d.%d", &major, &minor);
+        }
+        const auto atLeast = [&](GLint maj, GLint min)
+        {
+            return major > maj || (major == maj && minor >= min);
+        };
+        const auto getStringi = reinterpret_cast<GLFunctions::GetStringi>(sf::Context::getFunction("glGetStringi"));
+
+        //buffer objects themselves are core from 1.5
+        f.textureStorage = atLeast(4, 2) || hasExtension("GL_ARB_texture_storage", major, getStringi);
+        f.pixelBuffers = atLeast(2, 1) || (atLeast(1, 5) && hasExtension("GL_ARB_pixel_buffer_object", major, getStringi));
+
+        glFunctions = f;
+        return glFunctions;
+    }
+
+    const GLFunctions& getGLFunctions()
+    {
+        return glFunctions;
+    }
+
+    //copies a plane into a tightly packed buffer
+    void copyPlane(const VideoDecoder::Plane& plane, std::uint8_t* dst)
+    {
+        if (plane.stride == plane.width)
+        {
+            std::memcpy(dst, plane.data, plane.width * plane.height);
+        }
+        else
+        {
+            for (auto y = 0u; y < plane.height; ++y)
+            {
+                std::memcpy(dst + (y * plane.width), plane.data + (y * plane.stride), plane.width);
+            }
+        }
+    }
 }
 
 VideoTexture::VideoTexture()
-    : m_plm             (nullptr),
-    m_looped            (false),
+    : m_threaded        (false),
+    m_audioBufferCapacity(32768),
+    m_audioDither       (false),
+    m_audioSampleRate   (0),
+    m_pixelBufferCount  (0),
+    m_audioSync         (false),
+    m_audioSyncTolerance(0.04f),
+    m_avOffset          (0.f),
     m_timeAccumulator   (0.f),
     m_frameTime         (0.f),
-    m_state             (State::Stopped)
+    m_state             (State::Stopped),
+    m_pendingFrame      (nullptr),
+    m_pixelBufferIndex  (0),
+    m_pixelBufferSize   (0),
+    m_frameRead         (0),
+    m_frameWrite        (0),
+    m_threadRunning     (false),
+    m_decodeEnded       (false),
+    m_framePending      (false),
+    m_decodeTime        (0.f),
+    m_playbackTime      (0.f),
+    m_position          (0.f),
+    m_positionTimestamp (0.f)
 {
     //TODO we don't really want to create a shader for EVERY instance
     //in an ideal world we'd create a single instance and pass it in here
@@ -100,18 +258,40 @@ VideoTexture::VideoTexture()
 
     if (!m_shader.loadFromMemory(ShaderFragment, sf::Shader::Fragment))
     {
-        std::cout << "Failed creating shader for video renderer" << std::endl;
+        std::cout << "Failed creating shader for video renderer, frames will be converted on the CPU" << std::endl;
     }
+
+    m_decoder.setFrameCallback([&](const VideoDecoder::Frame& frame)
+        {
+            if (m_threadRunning)
+            {
+                //no GL on the worker thread - copy the planes to the queue
+                queueFrame(frame);
+            }
+            else
+            {
+                m_pendingFrame = &frame;
+            }
+        });
+
+    m_decoder.setAudioCallback([&](const float* samples, double time)
+        {
+            m_audioStream.pushData(samples, time);
+        });
 }
 
 VideoTexture::~VideoTexture()
 {
-    if (m_plm)
+    stopDecodeThread();
+
+    if (m_decoder.isOpen())
     {
         stop();
 
-        plm_destroy(m_plm);
+        m_decoder.close();
     }
+
+    destroyPixelBuffers();
 }
 
 bool VideoTexture::loadFromFile(const std::string& path)
@@ -121,80 +301,74 @@ bool VideoTexture::loadFromFile(const std::string& path)
     {
         stop();
     }   
-    
-    if (m_plm)
-    {
-        plm_destroy(m_plm);
-        m_plm = nullptr;
-    }   
-    
-    
-    if (m_shader.getNativeHandle() == 0)
-    {
-        std::cout << "Unable to open file " << path << ": shader not loaded";
-        return false;
-    }
 
+    stopDecodeThread();
+    m_decoder.close();
+    m_pendingFrame = nullptr;
+    
 
-    //load the file
-    m_plm = plm_create_with_filename(path.c_str());
-
-    if (!m_plm)
+    if (!m_decoder.open(path))
     {
-        std::cout << "Failed creating video player instance (incompatible file or incorrect file name?)" << path << std::endl;
         return false;
     }
 
 
-    auto width = plm_get_width(m_plm);
-    auto height = plm_get_height(m_plm);
-    auto frameRate = plm_get_framerate(m_plm);
-
-    if (width == 0 || height == 0 || frameRate == 0)
-    {
-        std::cout << path << ": invalid file properties" << std::endl;
-        plm_destroy(m_plm);
-        m_plm = nullptr;
-
-        return false;
-    }
-
+    auto width = m_decoder.getWidth();
+    auto height = m_decoder.getHeight();
     
-    m_frameTime = 1.f / frameRate;
+    m_frameTime = 1.f / m_decoder.getFrameRate();
 
     //the plane sizes aren't actually the same
     //but this sets the texture property used
     //by the output sprite so that it matches
     //the render buffer size (which is this value)
+    //start with new textures as the storage of the old
+    //ones can't be resized if it was made immutable
+    m_y = sf::Texture();
+    m_cr = sf::Texture();
+    m_cb = sf::Texture();
+
     m_y.create(width, height);
     m_cr.create(width, height);
     m_cb.create(width, height);
     m_outputBuffer.create(width, height);
 
-    m_quad.setTexture(m_y);
-    m_shader.setUniform("u_textureY", m_y);
-    m_shader.setUniform("u_textureCR", m_cr);
-    m_shader.setUniform("u_textureCB", m_cb);
+    if (m_shader.getNativeHandle() != 0)
+    {
+        m_cpuPixels.clear();
+        createPlaneStorage(width, height);
 
-    plm_set_video_decode_callback(m_plm, Detail::videoCallback, this);
+        m_shader.setUniform("u_textureY", m_y);
+        m_shader.setUniform("u_textureCR", m_cr);
+        m_shader.setUniform("u_textureCB", m_cb);
+    }
+    else
+    {
+        //without the shader frames are converted to RGBA
+        //and drawn straight from m_y, which stays RGBA
+        destroyPixelBuffers();
+        m_cpuPixels.assign(width * height * 4, 255);
+    }
+    m_quad.setTexture(m_y);
 
     //enable audio
-    plm_set_audio_decode_callback(m_plm, Detail::audioCallback, this);
-
-    if (plm_get_num_audio_streams(m_plm) > 0)
+    if (m_decoder.hasAudio())
     {
-        auto sampleRate = plm_get_samplerate(m_plm);
-        m_audioStream.init(ChannelCount, sampleRate);
-        m_audioStream.hasAudio = true;
+        auto sampleRate = m_decoder.getSampleRate();
+        m_audioStream.hasAudio = m_audioStream.init(ChannelCount, sampleRate, m_audioSampleRate, m_audioBufferCapacity, m_audioDither);
 
-        plm_set_audio_lead_time(m_plm, static_cast<double>(AudioBufferSize) / sampleRate);
+        m_decoder.setAudioLeadTime(static_cast<float>(AudioBufferSize) / sampleRate);
     }
     else
     {
+        m_audioStream.close();
         m_audioStream.hasAudio = false;
     }
 
-    plm_set_loop(m_plm, m_looped ? 1 : 0);
+    if (m_threaded)
+    {
+        startDecodeThread();
+    }
 
     return true;
 }
@@ -209,31 +383,62 @@ void VideoTexture::update(float dt)
         m_timeAccumulator = 0.f;
     }
 
-    if (m_plm)
+    if (m_decoder.isOpen())
     {
         assert(m_frameTime > 0);
+
+        syncToAudio();
+
+        if (m_threadRunning)
+        {
+            //the worker does the decoding, we just advance
+            //the clock and show whatever is ready
+            while (m_timeAccumulator > m_frameTime)
+            {
+                m_timeAccumulator -= m_frameTime;
+
+                if (m_state == State::Playing)
+                {
+                    m_playbackTime += m_frameTime;
+                }
+            }
+
+            presentFrames();
+
+            if (m_decodeEnded
+                && m_frameRead == m_frameWrite)
+            {
+                stop();
+            }
+            return;
+        }
+
         while (m_timeAccumulator > m_frameTime)
         {
             m_timeAccumulator -= m_frameTime;
 
             if (m_state == State::Playing)
             {
-                plm_decode(m_plm, m_frameTime);
+                //if we're catching up then anything decoded before the
+                //final step won't be seen, so don't bother with B-frames
+                m_decoder.setSkipBFrames(m_timeAccumulator > m_frameTime);
+                m_decoder.decode(m_frameTime);
+                m_decoder.setSkipBFrames(false);
 
-                updateBuffer();
-
-                if (plm_has_ended(m_plm))
+                if (m_decoder.hasEnded())
                 {
                     stop();
                 }
             }
         }
+
+        uploadFrame();
     }
 }
 
 void VideoTexture::play()
 {
-    if (m_plm == nullptr)
+    if (!m_decoder.isOpen())
     {
         std::cout << "No video file loaded " << std::endl;
         return;
@@ -256,6 +461,8 @@ void VideoTexture::play()
     {
         m_audioStream.play();
     }
+
+    notifyDecoder();
 }
 
 void VideoTexture::pause()
@@ -273,11 +480,24 @@ void VideoTexture::stop()
     {
         m_state = State::Stopped;
         m_audioStream.stop();
+        m_avOffset = 0.f;
 
-        if (m_plm)
+        if (m_decoder.isOpen())
         {
-            //rewind the file
-            plm_seek(m_plm, 0, FALSE);
+            std::lock_guard<std::mutex> lock(m_decodeMutex);
+
+            //rewind the file. The decode thread is parked while we
+            //hold the lock, so it's safe to reset the audio ring too
+            m_decoder.seek(0.f);
+            m_pendingFrame = nullptr;
+            m_audioStream.reset();
+
+            flushFrames();
+            m_decodeEnded = false;
+            m_decodeTime = 0.f;
+            m_playbackTime = 0.f;
+            m_position = 0.f;
+            m_positionTimestamp = 0.f;
 
             //clear the buffer else we repeat the last frame
             m_outputBuffer.clear(sf::Color::Blue);
@@ -288,124 +508,652 @@ void VideoTexture::stop()
 
 void VideoTexture::seek(float position)
 {
-    if (m_plm)
+    if (m_decoder.isOpen())
     {
-        plm_seek(m_plm, position, FALSE);
+        if (m_threadRunning)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_decodeMutex);
+
+                //drop anything decoded from the old position and queue
+                //the frame we seek to so that it is presented immediately
+                flushFrames();
+                m_decoder.seek(position);
+                publishFrame(m_playbackTime);
+
+                m_decodeEnded = false;
+                m_decodeTime = m_playbackTime;
+            }
+            notifyDecoder();
+
+            if (m_state != State::Playing)
+            {
+                presentFrames();
+            }
+            return;
+        }
+
+        m_decoder.seek(position);
 
         if (m_state != State::Playing)
         {
-            updateBuffer();
+            uploadFrame();
         }
     }
 }
 
 float VideoTexture::getDuration() const
 {
-    if (m_plm)
-    {
-        return static_cast<float>(plm_get_duration(m_plm));
-    }
-    return 0.f;
+    return m_decoder.getDuration();
 }
 
 float VideoTexture::getPosition() const
 {
-    if (m_plm)
+    if (m_threadRunning)
     {
-        return static_cast<float>(plm_get_time(m_plm));
+        //the decoder is ahead of what's on screen
+        return m_position;
     }
-    return 0.f;
+    return m_decoder.getTime();
 }
 
 void VideoTexture::setLooped(bool looped)
 {
-    m_looped = looped;
+    std::lock_guard<std::mutex> lock(m_decodeMutex);
+    m_decoder.setLooped(looped);
+}
 
-    if (m_plm)
-    {
-        plm_set_loop(m_plm, looped ? 1 : 0);
-    }
+void VideoTexture::setThreaded(bool threaded)
+{
+    m_threaded = threaded;
+}
+
+void VideoTexture::setSliceThreadCount(std::uint32_t count)
+{
+    m_decoder.setSliceThreadCount(count);
+}
+
+void VideoTexture::setSeekIndexEnabled(bool enabled)
+{
+    m_decoder.setSeekIndexEnabled(enabled);
+}
+
+void VideoTexture::setSeekIndexDirectory(const std::string& directory)
+{
+    m_decoder.setSeekIndexDirectory(directory);
+}
+
+void VideoTexture::setAudioBufferCapacity(std::uint32_t capacity)
+{
+    m_audioBufferCapacity = capacity;
+}
+
+void VideoTexture::setAudioDither(bool enabled)
+{
+    m_audioDither = enabled;
+}
+
+void VideoTexture::setAudioSampleRate(std::uint32_t rate)
+{
+    m_audioSampleRate = rate;
+}
+
+void VideoTexture::setVolume(float volume)
+{
+    m_audioStream.setVolume(volume);
+}
+
+void VideoTexture::setPixelBufferCount(std::uint32_t count)
+{
+    m_pixelBufferCount = std::min(count, 3u);
+}
+
+void VideoTexture::setAudioSync(bool enabled)
+{
+    m_audioSync = enabled;
+    m_avOffset = 0.f;
+}
+
+void VideoTexture::setAudioSyncTolerance(float tolerance)
+{
+    m_audioSyncTolerance = std::max(0.f, tolerance);
 }
 
 //private
-void VideoTexture::updateTexture(sf::Texture& t, plm_plane_t* plane)
+void VideoTexture::createPlaneStorage(std::uint32_t width, std::uint32_t height)
 {
     /*
     Planes only contain a single colour channel so we have to use OpenGL
-    directly to update the texture (SFML doesn't expose this). If you get
+    directly to create the textures (SFML doesn't expose this). If you get
     linker errors here make sure to link opengl
     */
 
+    destroyPixelBuffers();
+
+    //decoded planes are padded to a whole number of macroblocks
+    //and the chroma planes are half the size of the luma plane
+    const auto lumaWidth = ((width + 15) / 16) * 16;
+    const auto lumaHeight = ((height + 15) / 16) * 16;
+    m_planeSizes = { sf::Vector2u(lumaWidth, lumaHeight), sf::Vector2u(lumaWidth / 2, lumaHeight / 2), sf::Vector2u(lumaWidth / 2, lumaHeight / 2) };
+
+    const auto& gl = loadGLFunctions();
+
+    const std::array<sf::Texture*, 3> textures = { &m_y, &m_cb, &m_cr };
+    for (auto i = 0u; i < textures.size(); ++i)
+    {
+        assert(textures[i]->getNativeHandle());
+        glBindTexture(GL_TEXTURE_2D, textures[i]->getNativeHandle());
+
+        if (gl.hasTextureStorage())
+        {
+            gl.texStorage2D(GL_TEXTURE_2D, 1, GL_R8, m_planeSizes[i].x, m_planeSizes[i].y);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, m_planeSizes[i].x, m_planeSizes[i].y, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+
+    if (m_pixelBufferCount != 0)
+    {
+        if (gl.hasPixelBuffers())
+        {
+            m_pixelBufferSize = 0;
+            for (const auto& size : m_planeSizes)
+            {
+                m_pixelBufferSize += size.x * size.y;
+            }
+
+            m_pixelBuffers.resize(m_pixelBufferCount);
+            gl.genBuffers(static_cast<GLsizei>(m_pixelBuffers.size()), m_pixelBuffers.data());
+            for (auto buffer : m_pixelBuffers)
+            {
+                gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+                gl.bufferData(GL_PIXEL_UNPACK_BUFFER, m_pixelBufferSize, nullptr, GL_STREAM_DRAW);
+            }
+            gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            m_pixelBufferIndex = 0;
+        }
+        else
+        {
+            std::cout << "Pixel buffers are not supported, frames will be copied directly" << std::endl;
+        }
+    }
+}
+
+void VideoTexture::destroyPixelBuffers()
+{
+    if (!m_pixelBuffers.empty())
+    {
+        //the buffers are shared, so any of our contexts will do
+        m_outputBuffer.setActive(true);
+        getGLFunctions().deleteBuffers(static_cast<GLsizei>(m_pixelBuffers.size()), m_pixelBuffers.data());
+        m_pixelBuffers.clear();
+    }
+}
+
+void VideoTexture::updateTextures(const std::array<VideoDecoder::Plane, 3>& planes)
+{
+    if (!m_cpuPixels.empty())
+    {
+        const auto size = m_y.getSize();
+        VideoDecoder::convertToRGBA(planes, size.x, size.y, m_cpuPixels.data(), m_decoder.getSliceThreadCount());
+        m_y.update(m_cpuPixels.data());
+        return;
+    }
+
+    const std::array<sf::Texture*, 3> textures = { &m_y, &m_cb, &m_cr };
+
+    if (!m_pixelBuffers.empty())
+    {
+        const auto& gl = getGLFunctions();
+        gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffers[m_pixelBufferIndex]);
+        m_pixelBufferIndex = (m_pixelBufferIndex + 1) % m_pixelBuffers.size();
+
+        //orphaning the old storage means we don't have to wait
+        //for any transfer from it which is still in flight
+        gl.bufferData(GL_PIXEL_UNPACK_BUFFER, m_pixelBufferSize, nullptr, GL_STREAM_DRAW);
+        auto* dst = static_cast<std::uint8_t*>(gl.mapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY));
+        if (dst)
+        {
+            std::array<std::size_t, 3> offsets = {};
+            std::size_t offset = 0;
+            for (auto i = 0u; i < planes.size(); ++i)
+            {
+                offsets[i] = offset;
+                copyPlane(planes[i], dst + offset);
+                offset += planes[i].width * planes[i].height;
+            }
+
+            //the texture data pointers are offsets into the bound buffer
+            if (gl.unmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+            {
+                for (auto i = 0u; i < planes.size(); ++i)
+                {
+                    //copied planes are tightly packed
+                    auto plane = planes[i];
+                    plane.stride = plane.width;
+                    updateTexture(*textures[i], plane, reinterpret_cast<const void*>(offsets[i]));
+                }
+                gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                return;
+            }
+        }
+
+        //the buffer was lost or couldn't be mapped
+        gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    for (auto i = 0u; i < planes.size(); ++i)
+    {
+        updateTexture(*textures[i], planes[i], planes[i].data);
+    }
+}
+
+void VideoTexture::updateTexture(sf::Texture& t, const VideoDecoder::Plane& plane, const void* data)
+{
     assert(t.getNativeHandle());
     glBindTexture(GL_TEXTURE_2D, t.getNativeHandle());
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, plane->width, plane->height, 0, GL_RED, GL_UNSIGNED_BYTE, plane->data);
+
+    if (plane.stride != plane.width)
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, plane.stride);
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, plane.width, plane.height, GL_RED, GL_UNSIGNED_BYTE, data);
+
+    if (plane.stride != plane.width)
+    {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
 }
 
 void VideoTexture::updateBuffer()
 {
     m_outputBuffer.clear();
-    m_outputBuffer.draw(m_quad, &m_shader);
+    m_outputBuffer.draw(m_quad, m_cpuPixels.empty() ? &m_shader : nullptr);
     m_outputBuffer.display();
 }
 
+void VideoTexture::syncToAudio()
+{
+    float audioTime = 0.f;
+    if (!m_audioSync
+        || !m_audioStream.hasAudio
+        || m_state != State::Playing
+        || !m_audioStream.getPlaybackTime(audioTime))
+    {
+        return;
+    }
+
+    //where the video would be right now, including any
+    //time accumulated towards the next frame
+    float videoTime = 0.f;
+    if (m_threadRunning)
+    {
+        videoTime = m_position + (m_playbackTime + m_timeAccumulator - m_positionTimestamp);
+    }
+    else
+    {
+        videoTime = m_decoder.getTime() + m_timeAccumulator;
+    }
+
+    m_avOffset = videoTime - audioTime;
+
+    //after a seek or loop the ring still holds audio from before
+    //the jump, so ignore any offset that large until it's played out
+    static constexpr float MaxOffset = 1.f;
+    if (std::abs(m_avOffset) > m_audioSyncTolerance
+        && std::abs(m_avOffset) < MaxOffset)
+    {
+        //pulling the clock back repeats the current frame until the
+        //audio catches up, pushing it forward drops frames to catch up
+        if (m_threadRunning)
+        {
+            m_playbackTime -= m_avOffset;
+        }
+        else
+        {
+            m_timeAccumulator -= m_avOffset;
+        }
+    }
+}
+
+void VideoTexture::uploadFrame()
+{
+    if (m_pendingFrame)
+    {
+        updateTextures(m_pendingFrame->planes);
+        updateBuffer();
+
+        m_pendingFrame = nullptr;
+    }
+}
+
+void VideoTexture::startDecodeThread()
+{
+    assert(!m_threadRunning);
+
+    flushFrames();
+    m_decodeEnded = false;
+    m_decodeTime = 0.f;
+    m_playbackTime = 0.f;
+    m_position = 0.f;
+    m_positionTimestamp = 0.f;
+
+    m_threadRunning = true;
+    m_decodeThread = std::thread(&VideoTexture::threadFunc, this);
+}
+
+void VideoTexture::stopDecodeThread()
+{
+    if (m_threadRunning)
+    {
+        m_threadRunning = false;
+        notifyDecoder();
+
+        m_decodeThread.join();
+    }
+}
+
+void VideoTexture::threadFunc()
+{
+    while (m_threadRunning)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_queueMutex);
+            m_queueCondition.wait(lock, [&]()
+                {
+                    return !m_threadRunning
+                        || (m_state == State::Playing
+                            && !m_decodeEnded
+                            && m_frameWrite - m_frameRead < FrameQueueSize);
+                });
+        }
+
+        std::lock_guard<std::mutex> lock(m_decodeMutex);
+
+        //state may have changed while we were waiting for the lock
+        if (!m_threadRunning
+            || m_state != State::Playing
+            || m_decodeEnded)
+        {
+            continue;
+        }
+
+        m_decoder.decode(m_frameTime);
+        m_decodeTime += m_frameTime;
+        publishFrame(m_decodeTime);
+
+        if (m_decoder.hasEnded())
+        {
+            m_decodeEnded = true;
+        }
+    }
+}
+
+void VideoTexture::queueFrame(const VideoDecoder::Frame& frame)
+{
+    //this overwrites any frame already decoded during the current
+    //step, as only the newest one will ever be shown anyway
+    auto& dst = m_frameQueue[m_frameWrite % FrameQueueSize];
+    dst.position = static_cast<float>(frame.time);
+
+    for (auto i = 0u; i < frame.planes.size(); ++i)
+    {
+        const auto& plane = frame.planes[i];
+        dst.widths[i] = plane.width;
+        dst.heights[i] = plane.height;
+        dst.planes[i].resize(plane.width * plane.height);
+        copyPlane(plane, dst.planes[i].data());
+    }
+
+    m_framePending = true;
+}
+
+void VideoTexture::publishFrame(float timestamp)
+{
+    if (m_framePending)
+    {
+        m_framePending = false;
+        m_frameQueue[m_frameWrite % FrameQueueSize].timestamp = timestamp;
+        m_frameWrite.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void VideoTexture::flushFrames()
+{
+    //only called when the worker is idle or holds no lock on m_decoder
+    m_framePending = false;
+    m_frameRead = m_frameWrite.load();
+}
+
+void VideoTexture::presentFrames()
+{
+    auto read = m_frameRead.load(std::memory_order_relaxed);
+    const auto write = m_frameWrite.load(std::memory_order_acquire);
+
+    //skip any frames we're late for and show the newest due one
+    const DecodedFrame* frame = nullptr;
+    while (read != write
+        && m_frameQueue[read % FrameQueueSize].timestamp <= m_playbackTime)
+    {
+        frame = &m_frameQueue[read % FrameQueueSize];
+        read++;
+    }
+
+    if (frame)
+    {
+        std::array<VideoDecoder::Plane, 3> planes;
+        for (auto i = 0u; i < planes.size(); ++i)
+        {
+            planes[i].width = frame->widths[i];
+            planes[i].height = frame->heights[i];
+            planes[i].stride = frame->widths[i];
+            planes[i].data = frame->planes[i].data();
+        }
+        updateTextures(planes);
+        updateBuffer();
+        m_position = frame->position;
+        m_positionTimestamp = frame->timestamp;
+
+        //only hand the slots back once we're done reading them
+        m_frameRead.store(read, std::memory_order_release);
+        notifyDecoder();
+    }
+}
+
+void VideoTexture::notifyDecoder()
+{
+    //taking the lock makes sure the worker is either waiting or yet
+    //to test its wake condition, so the notification isn't lost
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+    }
+    m_queueCondition.notify_one();
+}
+
 
 /*
 Audio Stream....
 */
-bool VideoTexture::AudioStream::onGetData(sf::SoundStream::Chunk& chunk)
+VideoTexture::AudioStream::~AudioStream()
+{
+    close();
+}
+
+std::size_t VideoTexture::AudioStream::getAvailable() const
+{
+    return m_writeIndex.load() - m_readIndex.load(std::memory_order_relaxed);
+}
+
+void VideoTexture::AudioStream::mix(float* dst, std::size_t count)
 {
-    const auto getChunkSize = [&]()
+    const auto read = m_readIndex.load(std::memory_order_relaxed);
+    const auto available = std::min(m_writeIndex.load() - read, count);
+
+    //the rest of the mix is silent for this stream
+    if (available < count)
     {
-        auto in = static_cast<std::int32_t>(m_bufferIn);
-        auto out = static_cast<std::int32_t>(m_bufferOut);
-        auto chunkSize = (in - out) + static_cast<std::int32_t>(m_inBuffer.size());
-        chunkSize %= m_inBuffer.size();
+        m_underrunCount++;
+    }
 
-        chunkSize = std::min(chunkSize, static_cast<std::int32_t>(m_outBuffer.size()));
+    //mix in at most two parts, either side of the wrap around
+    const auto start = read & m_ringMask;
+    const auto first = std::min(available, m_ring.size() - start);
+    const float gain = m_gain;
+    AudioMixer::mixSamples(m_ring.data() + start, first, gain, dst);
+    AudioMixer::mixSamples(m_ring.data(), available - first, gain, dst + first);
 
-        return chunkSize;
-    };
+    m_readIndex.store(read + available, std::memory_order_release);
+}
 
+bool VideoTexture::AudioStream::init(std::uint32_t channels, std::uint32_t sampleRate, std::uint32_t outputRate, std::uint32_t capacity, bool dither)
+{
+    stop();
+    m_dither = dither;
 
-    auto chunkSize = getChunkSize();
+    //a running mixer keeps its rate, in which case outputRate is ignored
+    auto mixer = AudioMixer::get(outputRate != 0 ? outputRate : sampleRate);
+    outputRate = mixer->getSampleRate();
 
-    //wait for the buffer to fill
-    while (chunkSize == 0
-        && getStatus() == AudioStream::Status::Playing)
+    if (outputRate != sampleRate)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        chunkSize = getChunkSize();
+        if (!m_resampler.create(sampleRate, outputRate, channels))
+        {
+            std::cout << "Unable to resample audio from " << sampleRate << "Hz to " << outputRate << "Hz" << std::endl;
+            close();
+            return false;
+        }
+        m_resampleBuffer.resize(m_resampler.getOutputSize(SAMPLES_PER_FRAME) * channels);
+    }
+    else
+    {
+        m_resampler.destroy();
     }
 
-    for (auto i = 0; i < chunkSize; ++i)
+    if (mixer != m_mixer)
     {
-        auto idx = (m_bufferOut + i) % m_inBuffer.size();
-        m_outBuffer[i] = m_inBuffer[idx];
+        close();
+        m_mixer = mixer;
+        m_mixer->addChannel(this);
     }
 
-    chunk.sampleCount = chunkSize;
-    chunk.samples = m_outBuffer.data();
+    {
+        //stop the mixer reading the ring while it's resized
+        auto lock = m_mixer->lock();
 
-    m_bufferOut = (m_bufferOut + chunkSize) % m_inBuffer.size();
+        std::size_t size = 1;
+        while (size < capacity
+            || size < SAMPLES_PER_FRAME * 8)
+        {
+            size *= 2;
+        }
+        m_ring.resize(size);
+        m_ringMask = size - 1;
+        m_samplesPerSecond = outputRate * channels;
+    }
 
+    //counted since the file was loaded, so stopping doesn't clear it
+    m_underrunCount = 0;
+
+    reset();
     return true;
 }
 
-void VideoTexture::AudioStream::init(std::uint32_t channels, std::uint32_t sampleRate)
+void VideoTexture::AudioStream::close()
 {
     stop();
-    initialize(channels, sampleRate);
+    if (m_mixer)
+    {
+        m_mixer->removeChannel(this);
+        m_mixer.reset();
+    }
 }
 
-void VideoTexture::AudioStream::pushData(float* data)
+void VideoTexture::AudioStream::reset()
 {
-    for (auto i = 0u; i < AudioBufferSize; ++i)
+    if (!m_mixer)
     {
-        auto index = (m_bufferIn + i) % m_inBuffer.size();
+        return;
+    }
 
-        std::int16_t sample = data[i] * std::numeric_limits<std::int16_t>::max();
-        m_inBuffer[index] = sample;
+    auto lock = m_mixer->lock();
+
+    //start with some silence queued to cover the initial latency
+    std::fill(m_ring.begin(), m_ring.end(), 0);
+    m_readIndex = 0;
+    m_writeIndex = SAMPLES_PER_FRAME * 6;
+    m_hasTimeBase = false;
+
+    m_resampler.reset();
+}
+
+void VideoTexture::AudioStream::setVolume(float volume)
+{
+    m_volume = std::max(0.f, std::min(volume, 100.f));
+    m_gain = m_volume / 100.f;
+}
+
+bool VideoTexture::AudioStream::getPlaybackTime(float& time) const
+{
+    if (!m_hasTimeBase
+        || !m_mixer)
+    {
+        return false;
     }
 
-    m_bufferIn = (m_bufferIn + AudioBufferSize) % m_inBuffer.size();
+    //the latency is the audio mixed but not yet heard, so taking it
+    //from the read index gives the sample being heard
+    double heard = 0.0;
+    {
+        auto lock = m_mixer->lock();
+        heard = static_cast<double>(m_readIndex.load()) - (m_mixer->getLatency() * m_samplesPerSecond);
+    }
+
+    time = static_cast<float>(m_timeBase.load() + (heard / m_samplesPerSecond));
+    return true;
+}
+
+void VideoTexture::AudioStream::pushData(const float* data, double time)
+{
+    if (!m_mixer)
+    {
+        return;
+    }
+
+    //resampled frames vary in size, and lag the input slightly
+    std::size_t count = AudioBufferSize;
+    if (m_resampler.isActive())
+    {
+        count = m_resampler.process(data, SAMPLES_PER_FRAME, m_resampleBuffer.data()) * ChannelCount;
+        data = m_resampleBuffer.data();
+        time -= m_resampler.getDelay();
+    }
+
+    const auto write = m_writeIndex.load(std::memory_order_relaxed);
+    const auto read = m_readIndex.load(std::memory_order_acquire);
+
+    //rather than overwrite samples which haven't been played yet
+    //drop the frame if the audio device has fallen behind
+    if (m_ring.size() - (write - read) < count)
+    {
+        return;
+    }
+
+    const auto start = write & m_ringMask;
+    const auto first = std::min(count, m_ring.size() - start);
+    auto* dither = m_dither ? &m_ditherState : nullptr;
+    VideoDecoder::convertSamples(data, m_ring.data() + start, first, dither);
+    VideoDecoder::convertSamples(data + first, m_ring.data(), count - first, dither);
+
+    //audio is continuous so this maps every index in the ring to
+    //a time - it's refreshed each frame in case any were dropped
+    m_timeBase = time - (static_cast<double>(write) / m_samplesPerSecond);
+    m_hasTimeBase = true;
+
+    //sequentially consistent so that either the consumer sees the
+    //new data before it waits, or we see that it's waiting
+    m_writeIndex.store(write + count);
+
+    m_mixer->notify();
 }
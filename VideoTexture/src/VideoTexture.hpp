@@ -29,35 +29,24 @@ source distribution.
 
 #pragma once
 
-#include <SFML/Audio/SoundStream.hpp>
+#include "AudioMixer.hpp"
+#include "AudioResampler.hpp"
+#include "VideoDecoder.hpp"
 
 #include <SFML/Graphics/Shader.hpp>
 #include <SFML/Graphics/Texture.hpp>
 #include <SFML/Graphics/RenderTexture.hpp>
 #include <SFML/Graphics/Sprite.hpp>
 
+#include <string>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
-
-struct plm_t;
-typedef plm_t plm_t;
-
-struct plm_plane_t;
-typedef plm_plane_t plm_plane_t;
-
-struct plm_frame_t;
-typedef plm_frame_t plm_frame_t;
-
-struct plm_samples_t;
-typedef plm_samples_t plm_samples_t;
-
-
-namespace Detail
-{
-    void videoCallback(plm_t*, plm_frame_t*, void*);
-    void audioCallback(plm_t*, plm_samples_t*, void*);
-}
+#include <memory>
+#include <mutex>
+#include <thread>
 
 /*
 Video player class, which renders MPEG1 video to a texture using
@@ -75,6 +64,22 @@ You must, however, continue to update the VideoTexture regularly
 with the elapsed time in order to progress playback. See 
 VideoTexture::update().
 
+Decoding can optionally be moved to a worker thread with
+VideoTexture::setThreaded(), in which case update() only uploads
+the most recently decoded frame to the GPU. Large videos can
+additionally have the slices of each picture decoded across
+several threads with VideoTexture::setSliceThreadCount().
+
+Decoding itself is done by VideoDecoder, which has no dependency on
+SFML or OpenGL and can be used directly where there's no display.
+
+Frames are converted to RGB by a shader. If the shader can't be
+created they are converted on the CPU instead, which is slower.
+
+The audio of all VideoTextures is played through one shared
+AudioMixer, so playing many videos at once doesn't start an audio
+thread for each of them. See VideoTexture::setVolume().
+
 */
 
 class VideoTexture final
@@ -96,6 +101,8 @@ public:
 
     /*!
     \brief Attempts to open an MPEG1 file.
+    On Linux and other POSIX systems the file is memory mapped
+    rather than read into an intermediate buffer.
     \returns true on success or false if the file doesn't
     exist or is not a valid MPEG1 file.
     */
@@ -108,7 +115,9 @@ public:
     frames will be skipped.
     \param dt The time since this function was last called
 
-    hmmmmm - shame we can't spin this off into a thread, but OpenGL.
+    When threaded decoding is enabled this only uploads the newest
+    frame decoded by the worker thread, else the file is decoded
+    here on the calling thread.
     */
     void update(float dt);
 
@@ -160,7 +169,203 @@ public:
     /*!
     \brief Gets whether or not playback is currently set to looped
     */
-    bool getLooped() const { return m_looped; };
+    bool getLooped() const { return m_decoder.getLooped(); };
+
+    /*!
+    \brief Enables or disables decoding on a background thread.
+    When enabled the file is demuxed and decoded on a worker thread
+    which fills a small queue of decoded frames, leaving only the
+    texture upload to update(). This takes effect the next time
+    loadFromFile() is called. Disabled by default.
+    \param threaded - True to decode on a worker thread.
+    */
+    void setThreaded(bool threaded);
+
+    /*!
+    \brief Returns whether or not threaded decoding is enabled
+    */
+    bool getThreaded() const { return m_threaded; }
+
+    /*!
+    \brief Sets the number of threads used to decode the slices of
+    each video picture. MPEG1 pictures are split into rows of slices
+    which can be decoded independently, so high resolution videos
+    benefit from spreading these over multiple cores. The thread
+    which calls the decoder is included in the count, so values of
+    0 or 1 decode serially. This takes effect the next time
+    loadFromFile() is called. Defaults to 0.
+    If frames are being converted on the CPU because the shader is
+    unavailable the conversion is spread over this many threads too.
+    \param count - Number of threads, eg std::thread::hardware_concurrency()
+    */
+    void setSliceThreadCount(std::uint32_t count);
+
+    /*!
+    \brief Returns the number of threads used to decode video slices
+    */
+    std::uint32_t getSliceThreadCount() const { return m_decoder.getSliceThreadCount(); }
+
+    /*!
+    \brief Enables or disables building a seek index when a file is
+    loaded. The index maps the time of every keyframe to its position
+    in the file, so that seek() jumps straight to it rather than
+    searching for it - this makes scrubbing much smoother, especially
+    with variable bitrate files. Building the index requires reading
+    the whole file once, so it is saved to a sidecar file (see
+    setSeekIndexDirectory()) and reused until the video file changes.
+    This takes effect the next time loadFromFile() is called.
+    Disabled by default.
+    \param enabled - True to build a seek index on load
+    */
+    void setSeekIndexEnabled(bool enabled);
+
+    /*!
+    \brief Returns whether or not a seek index is built on load
+    */
+    bool getSeekIndexEnabled() const { return m_decoder.getSeekIndexEnabled(); }
+
+    /*!
+    \brief Sets the capacity of the buffer between the audio decoder
+    and the audio device, in samples. This needs to hold the audio
+    decoded ahead of the video, which is more when decoding on a
+    background thread - if the buffer is full newly decoded audio is
+    dropped. The value is rounded up to a power of two and takes
+    effect the next time loadFromFile() is called. Defaults to 32768,
+    about 0.34 seconds of 48kHz stereo.
+    \param capacity - Capacity in samples
+    */
+    void setAudioBufferCapacity(std::uint32_t capacity);
+
+    /*!
+    \brief Returns the capacity of the audio buffer in samples
+    */
+    std::uint32_t getAudioBufferCapacity() const { return m_audioBufferCapacity; }
+
+    /*!
+    \brief Enables or disables dithering when decoded audio is
+    converted to 16 bit for the audio device. Dither replaces the
+    distortion heard on quiet passages and fades with a very low
+    level of noise. Takes effect the next time loadFromFile() is
+    called. Disabled by default.
+    \param enabled - True to dither audio
+    */
+    void setAudioDither(bool enabled);
+
+    /*!
+    \brief Returns whether or not audio is dithered
+    */
+    bool getAudioDither() const { return m_audioDither; }
+
+    /*!
+    \brief Sets the sample rate at which audio is sent to the audio
+    device. All videos are mixed into a single stream, which is opened
+    at this rate by the first video to load a file with audio and
+    stays at it until every video using it has been destroyed. Audio
+    at any other rate is converted with a built in resampler, so set
+    this to the device rate, usually 48000. The short delay this adds
+    is accounted for by audio sync. Videos whose rate is more than
+    four times the stream's, or not a simple enough ratio of it, are
+    played silently. Takes effect the next time loadFromFile() is
+    called. Defaults to 0, which opens the stream at the rate of the
+    first video loaded.
+    \param rate - Sample rate in Hz, or 0
+    */
+    void setAudioSampleRate(std::uint32_t rate);
+
+    /*!
+    \brief Returns the sample rate set with setAudioSampleRate()
+    */
+    std::uint32_t getAudioSampleRate() const { return m_audioSampleRate; }
+
+    /*!
+    \brief Sets the volume of this video's audio, from 0 (silent) to
+    100 (full volume). Defaults to 100.
+    \param volume - Volume in the range 0 - 100
+    */
+    void setVolume(float volume);
+
+    /*!
+    \brief Returns the volume of this video's audio
+    */
+    float getVolume() const { return m_audioStream.getVolume(); }
+
+    /*!
+    \brief Sets the number of pixel buffer objects used to stream
+    decoded frames to the GPU. With 0 (the default) frames are copied
+    straight into the textures, which may stall until the driver has
+    finished with them. Using 2 or 3 lets the driver transfer a frame
+    asynchronously while the next is being written. Pixel buffers
+    require OpenGL 2.1 - if they're unavailable frames are copied
+    directly. Takes effect the next time loadFromFile() is called.
+    \param count - Number of pixel buffers, at most 3
+    */
+    void setPixelBufferCount(std::uint32_t count);
+
+    /*!
+    \brief Returns the number of pixel buffer objects requested
+    */
+    std::uint32_t getPixelBufferCount() const { return m_pixelBufferCount; }
+
+    /*!
+    \brief Returns the number of times the audio device requested
+    more audio than had been decoded since the file was loaded. Each
+    underrun is heard as a gap, so if this keeps increasing during
+    playback try a larger audio buffer or threaded decoding. Running
+    out at the end of a file is counted too.
+    */
+    std::uint32_t getAudioUnderrunCount() const { return m_audioStream.getUnderrunCount(); }
+
+    /*!
+    \brief Enables or disables synchronising the video to the audio.
+    By default video frames are presented according to the time passed
+    to update(), which slowly drifts from the audio device's clock.
+    When enabled the audio stream's playback position is the master
+    clock, and video frames are dropped or repeated whenever the
+    video is further than the sync tolerance away from it. This has
+    no effect on files without audio. Disabled by default.
+    \param enabled - True to synchronise video to the audio
+    */
+    void setAudioSync(bool enabled);
+
+    /*!
+    \brief Returns whether or not video is synchronised to the audio
+    */
+    bool getAudioSync() const { return m_audioSync; }
+
+    /*!
+    \brief Sets how far, in seconds, the video may drift from the
+    audio before it is corrected when audio sync is enabled.
+    Defaults to 0.04, about a frame at 25fps.
+    \param tolerance - Maximum drift in seconds
+    */
+    void setAudioSyncTolerance(float tolerance);
+
+    /*!
+    \brief Returns the audio sync tolerance in seconds
+    */
+    float getAudioSyncTolerance() const { return m_audioSyncTolerance; }
+
+    /*!
+    \brief Returns the offset, in seconds, between the video frame
+    currently shown and the audio currently heard, as measured by the
+    last call to update() while audio sync is enabled. Positive values
+    mean the video is ahead of the audio.
+    */
+    float getAVOffset() const { return m_avOffset; }
+
+    /*!
+    \brief Sets the directory in which seek index files are stored.
+    By default this is empty and the index for a video is saved next
+    to it, with .vtidx appended to the file name. Use this if the
+    video directory is read-only, or to keep the files in a cache.
+    \param directory - Path to an existing directory
+    */
+    void setSeekIndexDirectory(const std::string& directory);
+
+    /*!
+    \brief Returns the directory in which seek index files are stored
+    */
+    const std::string& getSeekIndexDirectory() const { return m_decoder.getSeekIndexDirectory(); }
 
     /*!
     \brief Returns a reference to the texture to which the video is
@@ -170,8 +375,15 @@ public:
 
 private:
 
-    plm_t* m_plm;
-    bool m_looped;
+    VideoDecoder m_decoder;
+    bool m_threaded;
+    std::uint32_t m_audioBufferCapacity;
+    bool m_audioDither;
+    std::uint32_t m_audioSampleRate;
+    std::uint32_t m_pixelBufferCount;
+    bool m_audioSync;
+    float m_audioSyncTolerance;
+    float m_avOffset;
 
     float m_timeAccumulator;
     float m_frameTime;
@@ -179,7 +391,8 @@ private:
     enum class State
     {
         Stopped, Playing, Paused
-    }m_state;
+    };
+    std::atomic<State> m_state;
 
     sf::Shader m_shader;
 
@@ -193,33 +406,141 @@ private:
     sf::Sprite m_quad; 
     sf::RenderTexture m_outputBuffer;
 
-    void updateTexture(sf::Texture&, plm_plane_t*);
+    //when update() catches up on several frames at once only the
+    //newest is uploaded, so the decode callback just stores it here.
+    //It remains valid until the decoder is next used
+    const VideoDecoder::Frame* m_pendingFrame;
+
+    //texture storage is allocated once per file at the size of the
+    //decoded planes, and each frame is copied into it, optionally
+    //via a ring of pixel buffers
+    std::array<sf::Vector2u, 3> m_planeSizes;
+    std::vector<std::uint32_t> m_pixelBuffers;
+    std::uint32_t m_pixelBufferIndex;
+    std::size_t m_pixelBufferSize;
+
+    //if the shader failed to load frames are converted to RGBA on
+    //the CPU instead, in which case this holds the converted frame
+    std::vector<std::uint8_t> m_cpuPixels;
+
+    void createPlaneStorage(std::uint32_t width, std::uint32_t height);
+    void destroyPixelBuffers();
+    void updateTextures(const std::array<VideoDecoder::Plane, 3>&);
+    void updateTexture(sf::Texture&, const VideoDecoder::Plane&, const void* data);
     void updateBuffer();
+    void uploadFrame();
+    void syncToAudio();
 
 
-    class AudioStream final : public sf::SoundStream
+    //threaded decoding. The worker thread is the only producer and
+    //update() the only consumer of the frame queue, so the read and
+    //write indices are enough to keep them apart without locking.
+    //m_decodeMutex guards m_decoder, which isn't thread safe.
+    struct DecodedFrame final
+    {
+        float timestamp = 0.f; //playback time at which this is shown
+        float position = 0.f; //time within the file
+        std::array<std::uint32_t, 3> widths = {};
+        std::array<std::uint32_t, 3> heights = {};
+        std::array<std::vector<std::uint8_t>, 3> planes; //Y, Cb, Cr
+    };
+    static constexpr std::uint32_t FrameQueueSize = 4;
+    std::array<DecodedFrame, FrameQueueSize> m_frameQueue;
+    std::atomic<std::uint32_t> m_frameRead;
+    std::atomic<std::uint32_t> m_frameWrite;
+
+    std::thread m_decodeThread;
+    std::atomic<bool> m_threadRunning;
+    std::atomic<bool> m_decodeEnded;
+    mutable std::mutex m_decodeMutex;
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueCondition;
+
+    bool m_framePending; //written by the decode callback under m_decodeMutex
+    float m_decodeTime;
+    float m_playbackTime;
+    float m_position;
+    float m_positionTimestamp; //playback time at which m_position was due
+
+    void startDecodeThread();
+    void stopDecodeThread();
+    void threadFunc();
+    void queueFrame(const VideoDecoder::Frame&);
+    void publishFrame(float timestamp);
+    void flushFrames();
+    void presentFrames();
+    void notifyDecoder();
+
+
+    class AudioStream final : public AudioMixer::Channel
     {
     public:
+        ~AudioStream();
+
         bool hasAudio = false;
 
-        bool onGetData(sf::SoundStream::Chunk&) override;
-        void onSeek(sf::Time) override {}
+        bool isPlaying() const override { return m_playing; }
+        std::size_t getAvailable() const override;
+        void mix(float*, std::size_t) override;
+
+        //joins the shared mixer, which is opened at outputRate, or
+        //sampleRate if it's 0. Audio is resampled to the mixer's rate.
+        //returns false if that's not possible
+        bool init(std::uint32_t channels, std::uint32_t sampleRate, std::uint32_t outputRate, std::uint32_t capacity, bool dither);
+
+        //leaves the mixer, eg when a file without audio is loaded
+        void close();
 
-        void init(std::uint32_t channels, std::uint32_t sampleRate);
+        void play() { m_playing = true; }
+        void pause() { m_playing = false; }
+        void stop() { m_playing = false; }
 
-        void pushData(float*);
+        //the producer writes the ring without locking, so this must
+        //only be called while the decoder is stopped or m_decodeMutex
+        //is held
+        void reset();
+
+        void setVolume(float volume);
+        float getVolume() const { return m_volume; }
+
+        void pushData(const float*, double time);
+
+        //the time within the file of the audio currently being
+        //heard, or false if no audio has been decoded yet
+        bool getPlaybackTime(float& time) const;
+
+        std::uint32_t getUnderrunCount() const { return m_underrunCount; }
 
     private:
         static constexpr std::int32_t SAMPLES_PER_FRAME = 1152;
-        std::array<std::int16_t, SAMPLES_PER_FRAME * 8> m_inBuffer = {};
-        std::array<std::int16_t, SAMPLES_PER_FRAME * 2> m_outBuffer = {};
 
-        std::uint32_t m_bufferIn = SAMPLES_PER_FRAME * 6;
-        std::uint32_t m_bufferOut = 2;
+        std::shared_ptr<AudioMixer> m_mixer;
+        std::atomic<bool> m_playing{ false };
+        std::atomic<float> m_gain{ 1.f };
+        float m_volume = 100.f;
+
+        //single producer (the decoder) single consumer (the mixer's
+        //audio thread) ring buffer. The indices only ever increase and are
+        //masked when accessing the ring, so its size is a power of 2
+        //and write - read is always the number of samples queued.
+        std::vector<std::int16_t> m_ring;
+        std::size_t m_ringMask = 0;
+        std::atomic<std::size_t> m_writeIndex{ 0 };
+        std::atomic<std::size_t> m_readIndex{ 0 };
+
+        std::atomic<std::uint32_t> m_underrunCount{ 0 };
+
+        //decoded audio is continuous so a single time at which the
+        //ring index would be 0 maps any index to a time in the file
+        std::uint32_t m_samplesPerSecond = 0;
+        std::atomic<double> m_timeBase{ 0.0 };
+        std::atomic<bool> m_hasTimeBase{ false };
+
+        //only touched by the producer, or by reset()
+        bool m_dither = false;
+        VideoDecoder::DitherState m_ditherState = { 0x9E3779B9, 0x85EBCA6B, 0xC2B2AE35, 0x27D4EB2F };
+        AudioResampler m_resampler;
+        std::vector<float> m_resampleBuffer;
 
     }m_audioStream;
-
-    //because function pointers
-    friend void Detail::videoCallback(plm_t*, plm_frame_t*, void*);
-    friend void Detail::audioCallback(plm_t*, plm_samples_t*, void*);
 };
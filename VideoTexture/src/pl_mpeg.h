@@ -154,6 +154,20 @@ the default buffer size by defining PLM_BUFFER_DEFAULT_SIZE *before*
 including this library.
 
 
+The hot paths of the video decoder have SSE2/AVX2 (x86) and NEON (ARM)
+implementations, which produce exactly the same output as the plain C code.
+SSE2 and NEON are used whenever the compiler targets them; AVX2 is always
+compiled on x86 but only used if the CPU supports it, so the same binary runs
+everywhere. Define PLM_NO_SIMD *before* including this library to only use the
+plain C code.
+
+
+On POSIX systems files can also be memory mapped instead of read through 
+fread(), see plm_create_with_mapped_file(). Define PLM_NO_MMAP *before* 
+including this library to disable this; the function then behaves exactly
+like plm_create_with_filename().
+
+
 See below for detailed the API documentation.
 
 */
@@ -181,6 +195,7 @@ typedef struct plm_buffer_t plm_buffer_t;
 typedef struct plm_demux_t plm_demux_t;
 typedef struct plm_video_t plm_video_t;
 typedef struct plm_audio_t plm_audio_t;
+typedef struct plm_resampler_t plm_resampler_t;
 
 
 // Demuxed MPEG PS packet
@@ -198,6 +213,28 @@ typedef struct {
 } plm_packet_t;
 
 
+// Seek index entry
+// The PTS of a packet that contains an intra frame and the byte position in the
+// data source just after the packet's start code. See 
+// plm_demux_build_seek_index().
+
+typedef struct {
+    double pts;
+    size_t pos;
+} plm_demux_seek_index_entry_t;
+
+
+// Timing of a packet type in the data source
+// start_time is the PTS of the first packet of that type and duration the span
+// to the PTS of the last one, both in seconds. See plm_demux_get_probe().
+
+typedef struct {
+    int type;
+    double start_time;
+    double duration;
+} plm_demux_probe_t;
+
+
 // Decoded Video Plane 
 // The byte length of the data is width * height. Note that different planes
 // have different sizes: the Luma plane (Y) is double the size of each of 
@@ -227,6 +264,18 @@ typedef struct plm_frame_t {
 } plm_frame_t;
 
 
+// Counters of how the blocks of the decoded video were reconstructed. Blocks
+// with only a DC coefficient are a constant fill (or add), blocks with all
+// coefficients in the top-left 4x4 use a reduced IDCT and the rest go through
+// the full IDCT.
+
+typedef struct {
+    uint64_t dc_only;
+    uint64_t sparse;
+    uint64_t full;
+} plm_video_block_stats_t;
+
+
 // Callback function type for decoded video frames used by the high-level
 // plm_* interface
 
@@ -234,6 +283,15 @@ typedef void(*plm_video_decode_callback)
     (plm_t *self, plm_frame_t *frame, void *user);
 
 
+// Callback function type for decoding the slices of a picture concurrently.
+// The callback must call plm_video_decode_slice_job() exactly once for every
+// index in [0, count) - from as many threads as it likes - and only return
+// once all of them have completed.
+
+typedef void(*plm_video_slice_callback)
+    (plm_video_t *self, int count, void *user);
+
+
 // Decoded Audio Samples
 // Samples are stored as normalized (-1, 1) float either interleaved, or if
 // PLM_AUDIO_SEPARATE_CHANNELS is defined, in two separate arrays.
@@ -278,6 +336,15 @@ typedef void(*plm_buffer_load_callback)(plm_buffer_t *self, void *user);
 plm_t *plm_create_with_filename(const char *filename);
 
 
+// Create a plmpeg instance with a filename and read the file through a memory
+// mapping. No data is copied and seeking is free, which pays off for files
+// that are opened repeatedly and likely to be in the page cache. Falls back to
+// plm_create_with_filename() where mapping is not available or fails. Returns
+// NULL if the file could not be opened.
+
+plm_t *plm_create_with_mapped_file(const char *filename);
+
+
 // Create a plmpeg instance with a file handle. Pass TRUE to close_when_done to
 // let plmpeg call fclose() on the handle when plm_destroy() is called.
 
@@ -406,6 +473,24 @@ void plm_set_video_decode_callback(plm_t *self, plm_video_decode_callback fp, vo
 void plm_set_audio_decode_callback(plm_t *self, plm_audio_decode_callback fp, void *user);
 
 
+// Set the callback used to decode the slices of each video picture in
+// parallel. See plm_video_set_slice_callback(). Default NULL.
+
+void plm_set_video_slice_callback(plm_t *self, plm_video_slice_callback fp, void *user);
+
+
+// Set whether B-frames are skipped rather than decoded. See
+// plm_video_set_skip_b_frames(). Default FALSE.
+
+void plm_set_video_skip_b_frames(plm_t *self, int skip);
+
+
+// Get the counters of the paths used to reconstruct video blocks since the
+// video decoder was created. See plm_video_block_stats_t.
+
+plm_video_block_stats_t plm_get_video_block_stats(plm_t *self);
+
+
 // Advance the internal timer by seconds and decode video/audio up to this time.
 // This will call the video_decode_callback and audio_decode_callback any number
 // of times. A frame-skip is not implemented, i.e. everything up to current time
@@ -455,6 +540,44 @@ int plm_seek(plm_t *self, double time, int seek_exact);
 plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 
 
+// Scan the whole source once and build an index of all intra frames in the
+// video stream, see plm_demux_build_seek_index(). Afterwards plm_seek() jumps 
+// straight to the right intra frame instead of estimating byte offsets. 
+// Returns TRUE if at least one intra frame was found.
+
+int plm_build_seek_index(plm_t *self);
+
+
+// Get the seek index of the video stream, e.g. to save it for the next time 
+// this file is opened. Returns NULL if there is no index, otherwise length 
+// receives the number of entries. The entries are valid until the index is
+// rebuilt or replaced, or until plm_destroy() is called.
+
+const plm_demux_seek_index_entry_t *plm_get_seek_index(plm_t *self, size_t *length);
+
+
+// Set the seek index of the video stream from previously saved entries instead
+// of building it. The entries are copied. Returns FALSE if there is no video
+// stream.
+
+int plm_set_seek_index(plm_t *self, const plm_demux_seek_index_entry_t *entries, size_t length);
+
+
+// Get the start time and duration of the video stream, probing the data source
+// if that hasn't happened yet. Returns FALSE if there is no video stream or 
+// its timing couldn't be determined.
+
+int plm_get_probe(plm_t *self, plm_demux_probe_t *probe);
+
+
+// Set the start time and duration of the video stream, e.g. from a previous
+// plm_get_probe() for the same file, so that the data source doesn't have to
+// be probed again. The type of the probe is ignored. Returns FALSE if there is 
+// no video stream.
+
+int plm_set_probe(plm_t *self, const plm_demux_probe_t *probe);
+
+
 
 // -----------------------------------------------------------------------------
 // plm_buffer public API
@@ -474,6 +597,13 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 plm_buffer_t *plm_buffer_create_with_filename(const char *filename);
 
 
+// Create a buffer instance by memory mapping a file. Falls back to 
+// plm_buffer_create_with_filename() where mapping is not available or fails.
+// Returns NULL if the file could not be opened.
+
+plm_buffer_t *plm_buffer_create_with_mapped_file(const char *filename);
+
+
 // Create a buffer instance with a file handle. Pass TRUE to close_when_done
 // to let plmpeg call fclose() on the handle when plm_destroy() is called.
 
@@ -630,6 +760,49 @@ double plm_demux_get_start_time(plm_demux_t *self, int type);
 double plm_demux_get_duration(plm_demux_t *self, int type);
 
 
+// Get the start time and duration for the specified packet type. Both are 
+// probed only once - the first packets of the data source are read to find the 
+// start time and the last packets to find the duration - and then reused by 
+// every call to plm_demux_get_start_time(), plm_demux_get_duration() and 
+// plm_demux_seek(). Returns FALSE if either couldn't be determined.
+
+int plm_demux_get_probe(plm_demux_t *self, int type, plm_demux_probe_t *probe);
+
+
+// Set the start time and duration for a packet type instead of probing them,
+// e.g. from a previous plm_demux_get_probe() for the same data source.
+
+void plm_demux_set_probe(plm_demux_t *self, const plm_demux_probe_t *probe);
+
+
+// Scan the whole source for packets of the specified type that contain an intra
+// frame and record their PTS and byte position. While the index is present, 
+// plm_demux_seek() with force_intra for this type does a binary search and a
+// single jump, which is much faster and more predictable for files with a 
+// variable bitrate. Like plm_demux_get_duration(), this only makes sense when
+// the underlying data source is a file or fixed memory. Returns TRUE if at 
+// least one intra frame was found.
+
+int plm_demux_build_seek_index(plm_demux_t *self, int type);
+
+
+// Returns TRUE/FALSE whether a seek index has been built.
+
+int plm_demux_has_seek_index(plm_demux_t *self);
+
+
+// Get the seek index. Returns NULL if there is none, otherwise length receives 
+// the number of entries.
+
+const plm_demux_seek_index_entry_t *plm_demux_get_seek_index(plm_demux_t *self, size_t *length);
+
+
+// Replace the seek index for the specified type with a copy of the entries, 
+// which have to be sorted by PTS. Passing a length of 0 removes the index.
+
+void plm_demux_set_seek_index(plm_demux_t *self, int type, const plm_demux_seek_index_entry_t *entries, size_t length);
+
+
 // Decode and return the next packet. The returned packet_t is valid until
 // the next call to plm_demux_decode() or until the demuxer is destroyed.
 
@@ -676,6 +849,15 @@ int plm_video_get_height(plm_video_t *self);
 void plm_video_set_no_delay(plm_video_t *self, int no_delay);
 
 
+// Set whether B-frames are skipped rather than decoded. No other picture
+// references a B-frame, so skipping them is safe and makes catching up after
+// a stall cheaper. A skipped B-frame still advances the time as usual, but
+// the frame returned for it is a repeat of the previous reference frame.
+// The default is FALSE.
+
+void plm_video_set_skip_b_frames(plm_video_t *self, int skip);
+
+
 // Get the current internal time in seconds.
 
 double plm_video_get_time(plm_video_t *self);
@@ -705,6 +887,28 @@ int plm_video_has_ended(plm_video_t *self);
 plm_frame_t *plm_video_decode(plm_video_t *self);
 
 
+// Set a callback to decode the slices of a picture in parallel. Slices reset
+// all predictors, so once a picture's slice start codes are known each one
+// can be decoded independently with its own bit reader. When set, the slice
+// positions of a picture are collected first and the callback is invoked with
+// their count; see plm_video_slice_callback. If NULL (the default), or if a
+// picture only has a single slice, slices are decoded serially.
+
+void plm_video_set_slice_callback(plm_video_t *self, plm_video_slice_callback fp, void *user);
+
+
+// Decode the slice with the given index of the picture currently being
+// decoded. This must only be called from within a plm_video_slice_callback.
+
+void plm_video_decode_slice_job(plm_video_t *self, int index);
+
+
+// Get the counters of the paths used to reconstruct blocks since the decoder
+// was created. See plm_video_block_stats_t.
+
+plm_video_block_stats_t plm_video_get_block_stats(plm_video_t *self);
+
+
 // Convert the YCrCb data of a frame into interleaved R G B data. The stride
 // specifies the width in bytes of the destination buffer. I.e. the number of
 // bytes from one line to the next. The stride must be at least 
@@ -720,6 +924,45 @@ void plm_frame_to_argb(plm_frame_t *frame, uint8_t *dest, int stride);
 void plm_frame_to_abgr(plm_frame_t *frame, uint8_t *dest, int stride);
 
 
+// Pixel formats for plm_frame_to_pixels(), named by the order of the bytes in
+// memory. As above, alpha bytes are left untouched.
+
+static const int PLM_PIXEL_FORMAT_RGB = 0;
+static const int PLM_PIXEL_FORMAT_BGR = 1;
+static const int PLM_PIXEL_FORMAT_RGBA = 2;
+static const int PLM_PIXEL_FORMAT_BGRA = 3;
+static const int PLM_PIXEL_FORMAT_ARGB = 4;
+static const int PLM_PIXEL_FORMAT_ABGR = 5;
+
+
+// YCbCr ranges for plm_frame_to_pixels(). MPEG-1 video uses the limited range
+// of BT.601, where black is at 16 and white at 235. Full range, as used by
+// JPEG, spans the whole 0-255 range.
+
+static const int PLM_COLOR_RANGE_LIMITED = 0;
+static const int PLM_COLOR_RANGE_FULL = 1;
+
+
+// Convert the YCrCb data of a frame into interleaved pixels of one of the
+// PLM_PIXEL_FORMAT_* formats, using one of the PLM_COLOR_RANGE_* ranges. This
+// uses SSE2, AVX2 or NEON where available. Unlike the functions above it also
+// converts the last column and row of frames with an odd width or height.
+
+void plm_frame_to_pixels(plm_frame_t *frame, uint8_t *dest, int stride, int format, int range);
+
+
+// As plm_frame_to_pixels(), with the planes given separately. Each plane is
+// y_stride or c_stride bytes from one row to the next, and the chroma planes
+// must cover at least half the width and height of the image, rounded up.
+// To convert a band of rows on its own, offset y and dest to an even row and
+// cb and cr to half that row.
+
+void plm_planes_to_pixels(
+    const uint8_t *y, int y_stride, const uint8_t *cb, const uint8_t *cr, int c_stride,
+    int width, int height, uint8_t *dest, int stride, int format, int range
+);
+
+
 // -----------------------------------------------------------------------------
 // plm_audio public API
 // Decode MPEG-1 Audio Layer II ("mp2") data into raw samples
@@ -776,6 +1019,73 @@ int plm_audio_has_ended(plm_audio_t *self);
 plm_samples_t *plm_audio_decode(plm_audio_t *self);
 
 
+// Convert count samples in the range -1 to 1 into signed 16bit samples, using
+// SSE2 or NEON where available. Samples outside the range are clamped rather
+// than wrapped. If dither isn't NULL, triangular (TPDF) dither of up to one
+// step either way is added before conversion. dither points to 4 random states
+// which are updated as they're used, each of which must be seeded non-zero.
+
+void plm_samples_to_s16(const float *src, int16_t *dest, int count, uint32_t *dither);
+
+
+// Add count signed 16bit samples, multiplied by gain, to the float samples in
+// dest, using SSE2 or NEON where available. Use this to mix several streams,
+// then plm_samples_round_to_s16() to convert the mix back to 16bit.
+
+void plm_samples_accumulate_s16(const int16_t *src, int count, float gain, float *dest);
+
+
+// Convert count float samples on the 16bit scale, eg as mixed by
+// plm_samples_accumulate_s16(), to signed 16bit. Samples are rounded to the
+// nearest value and clamped to the 16bit range, so a single stream mixed at a
+// gain of 1 comes back out unchanged.
+
+void plm_samples_round_to_s16(const float *src, int16_t *dest, int count);
+
+
+
+// -----------------------------------------------------------------------------
+// plm_resampler public API
+// Convert interleaved float samples from one sample rate to another with a
+// polyphase windowed sinc filter
+
+
+// Create a resampler from in_rate to out_rate, for 1 or 2 channels. The ratio
+// of the rates, reduced to its lowest terms, has to have a numerator and
+// denominator of at most 1024, and out_rate must be at least a quarter of
+// in_rate. Returns NULL if not.
+
+plm_resampler_t *plm_resampler_create(int in_rate, int out_rate, int channels);
+
+
+// Destroy a resampler and free all data.
+
+void plm_resampler_destroy(plm_resampler_t *self);
+
+
+// Discard the samples held in the filter, eg after seeking.
+
+void plm_resampler_reset(plm_resampler_t *self);
+
+
+// Get the most samples per channel that plm_resampler_process() may write for
+// the given number of input samples per channel.
+
+int plm_resampler_get_output_size(plm_resampler_t *self, int in_count);
+
+
+// Get the delay of the filter in seconds, by which the output lags the input.
+
+double plm_resampler_get_delay(plm_resampler_t *self);
+
+
+// Resample in_count samples per channel from src into dest and return the
+// number of samples per channel written. Samples that can't be output yet are
+// kept until the next call.
+
+int plm_resampler_process(plm_resampler_t *self, const float *src, int in_count, float *dest);
+
+
 
 #ifdef __cplusplus
 }
@@ -795,6 +1105,15 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self);
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+
+#if !defined(PLM_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+    #define PLM_MMAP
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 
 #ifndef TRUE
 #define TRUE 1
@@ -809,6 +1128,55 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self);
 #pragma warning(disable: 4244)
 #endif
 
+// SIMD support. SSE2 is part of x86-64 and NEON of ARM64, so these only depend
+// on the compile target. AVX2 functions are compiled separately and only 
+// selected at runtime, once the CPU has been checked for support.
+
+#ifndef PLM_NO_SIMD
+    #if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #define PLM_SIMD_SSE2
+        #include <emmintrin.h>
+
+        #if defined(_MSC_VER)
+            #define PLM_SIMD_AVX2
+            #define PLM_TARGET_AVX2
+            #include <intrin.h>
+            #include <immintrin.h>
+        #elif defined(__GNUC__)
+            #define PLM_SIMD_AVX2
+            #define PLM_TARGET_AVX2 __attribute__((target("avx2")))
+            #include <immintrin.h>
+        #endif
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        #define PLM_SIMD_NEON
+        #include <arm_neon.h>
+    #endif
+#endif
+
+#ifdef PLM_SIMD_AVX2
+static int plm_cpu_has_avx2(void) {
+    #if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return FALSE;
+        }
+
+        // The OS has to save the AVX registers too (OSXSAVE, AVX and XCR0)
+        __cpuid(info, 1);
+        if ((info[2] & (3 << 27)) != (3 << 27) || (_xgetbv(0) & 6) != 6) {
+            return FALSE;
+        }
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    #endif
+}
+#endif
+
 // -----------------------------------------------------------------------------
 // plm (high-level interface) implementation
 
@@ -836,6 +1204,10 @@ typedef struct plm_t {
 
     plm_audio_decode_callback audio_decode_callback;
     void *audio_decode_callback_user_data;
+
+    plm_video_slice_callback video_slice_callback;
+    void *video_slice_callback_user_data;
+    int video_skip_b_frames;
 } plm_t;
 
 int plm_init_decoders(plm_t *self);
@@ -852,6 +1224,14 @@ plm_t *plm_create_with_filename(const char *filename) {
     return plm_create_with_buffer(buffer, TRUE);
 }
 
+plm_t *plm_create_with_mapped_file(const char *filename) {
+    plm_buffer_t *buffer = plm_buffer_create_with_mapped_file(filename);
+    if (!buffer) {
+        return NULL;
+    }
+    return plm_create_with_buffer(buffer, TRUE);
+}
+
 plm_t *plm_create_with_file(FILE *fh, int close_when_done) {
     plm_buffer_t *buffer = plm_buffer_create_with_file(fh, close_when_done);
     return plm_create_with_buffer(buffer, TRUE);
@@ -901,6 +1281,12 @@ int plm_init_decoders(plm_t *self) {
 
     if (self->video_buffer) {
         self->video_decoder = plm_video_create_with_buffer(self->video_buffer, TRUE);
+        plm_video_set_slice_callback(
+            self->video_decoder,
+            self->video_slice_callback,
+            self->video_slice_callback_user_data
+        );
+        plm_video_set_skip_b_frames(self->video_decoder, self->video_skip_b_frames);
     }
 
     if (self->audio_buffer) {
@@ -1069,6 +1455,32 @@ void plm_set_audio_decode_callback(plm_t *self, plm_audio_decode_callback fp, vo
     self->audio_decode_callback_user_data = user;
 }
 
+void plm_set_video_slice_callback(plm_t *self, plm_video_slice_callback fp, void *user) {
+    self->video_slice_callback = fp;
+    self->video_slice_callback_user_data = user;
+
+    if (self->video_decoder) {
+        plm_video_set_slice_callback(self->video_decoder, fp, user);
+    }
+}
+
+void plm_set_video_skip_b_frames(plm_t *self, int skip) {
+    self->video_skip_b_frames = skip;
+
+    if (self->video_decoder) {
+        plm_video_set_skip_b_frames(self->video_decoder, skip);
+    }
+}
+
+plm_video_block_stats_t plm_get_video_block_stats(plm_t *self) {
+    if (self->video_decoder) {
+        return plm_video_get_block_stats(self->video_decoder);
+    }
+
+    plm_video_block_stats_t stats = {0, 0, 0};
+    return stats;
+}
+
 void plm_decode(plm_t *self, double tick) {
     if (!plm_init_decoders(self)) {
         return;
@@ -1267,6 +1679,62 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
     return frame;
 }
 
+int plm_build_seek_index(plm_t *self) {
+    if (!plm_init_decoders(self)) {
+        return FALSE;
+    }
+
+    if (!self->video_packet_type) {
+        return FALSE;
+    }
+
+    return plm_demux_build_seek_index(self->demux, self->video_packet_type);
+}
+
+const plm_demux_seek_index_entry_t *plm_get_seek_index(plm_t *self, size_t *length) {
+    return plm_demux_get_seek_index(self->demux, length);
+}
+
+int plm_set_seek_index(plm_t *self, const plm_demux_seek_index_entry_t *entries, size_t length) {
+    if (!plm_init_decoders(self)) {
+        return FALSE;
+    }
+
+    if (!self->video_packet_type) {
+        return FALSE;
+    }
+
+    plm_demux_set_seek_index(self->demux, self->video_packet_type, entries, length);
+    return TRUE;
+}
+
+int plm_get_probe(plm_t *self, plm_demux_probe_t *probe) {
+    if (!plm_init_decoders(self)) {
+        return FALSE;
+    }
+
+    if (!self->video_packet_type) {
+        return FALSE;
+    }
+
+    return plm_demux_get_probe(self->demux, self->video_packet_type, probe);
+}
+
+int plm_set_probe(plm_t *self, const plm_demux_probe_t *probe) {
+    if (!plm_init_decoders(self)) {
+        return FALSE;
+    }
+
+    if (!self->video_packet_type) {
+        return FALSE;
+    }
+
+    plm_demux_probe_t video_probe = *probe;
+    video_probe.type = self->video_packet_type;
+    plm_demux_set_probe(self->demux, &video_probe);
+    return TRUE;
+}
+
 int plm_seek(plm_t *self, double time, int seek_exact) {
     plm_frame_t *frame = plm_seek_frame(self, time, seek_exact);
     
@@ -1317,6 +1785,7 @@ int plm_seek(plm_t *self, double time, int seek_exact) {
 enum plm_buffer_mode {
     PLM_BUFFER_MODE_FILE,
     PLM_BUFFER_MODE_FIXED_MEM,
+    PLM_BUFFER_MODE_MAPPED,
     PLM_BUFFER_MODE_RING,
     PLM_BUFFER_MODE_APPEND
 };
@@ -1334,6 +1803,7 @@ typedef struct plm_buffer_t {
     plm_buffer_load_callback load_callback;
     void *load_callback_user_data;
     uint8_t *bytes;
+    size_t mapped_length;
     enum plm_buffer_mode mode;
 } plm_buffer_t;
 
@@ -1347,13 +1817,30 @@ typedef struct {
     uint16_t value;
 } plm_vlc_uint_t;
 
+// A VLC tree compiled into lookup tables. Entries with a positive length hold
+// a decoded value and the number of bits of its code. Entries with a negative 
+// length link to a secondary table of -length bits at offset value.
+typedef struct {
+    int16_t value;
+    int16_t length;
+} plm_vlc_lut_entry_t;
+
+typedef struct {
+    const plm_vlc_t *tree;
+    plm_vlc_lut_entry_t *entries;
+    int bits;
+} plm_vlc_lut_t;
+
 
 void plm_buffer_seek(plm_buffer_t *self, size_t pos);
 size_t plm_buffer_tell(plm_buffer_t *self);
 void plm_buffer_discard_read_bytes(plm_buffer_t *self);
+void plm_buffer_make_room(plm_buffer_t *self, size_t length);
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user);
 
 int plm_buffer_has(plm_buffer_t *self, size_t count);
+int plm_buffer_peek(plm_buffer_t *self, int count);
+void plm_buffer_consume(plm_buffer_t *self, int count);
 int plm_buffer_read(plm_buffer_t *self, int count);
 void plm_buffer_align(plm_buffer_t *self);
 void plm_buffer_skip(plm_buffer_t *self, size_t count);
@@ -1363,6 +1850,10 @@ int plm_buffer_find_start_code(plm_buffer_t *self, int code);
 int plm_buffer_no_start_code(plm_buffer_t *self);
 int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table);
 uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table);
+int16_t plm_buffer_read_vlc_lut(plm_buffer_t *self, const plm_vlc_lut_t *lut);
+
+void plm_vlc_lut_init(plm_vlc_lut_t *self, const plm_vlc_t *tree, int bits, int sub_bits);
+void plm_vlc_lut_free(plm_vlc_lut_t *self);
 
 plm_buffer_t *plm_buffer_create_with_filename(const char *filename) {
     FILE *fh = fopen(filename, "rb");
@@ -1372,6 +1863,41 @@ plm_buffer_t *plm_buffer_create_with_filename(const char *filename) {
     return plm_buffer_create_with_file(fh, TRUE);
 }
 
+plm_buffer_t *plm_buffer_create_with_mapped_file(const char *filename) {
+    #ifdef PLM_MMAP
+        int fd = open(filename, O_RDONLY);
+        if (fd == -1) {
+            return NULL;
+        }
+
+        struct stat st;
+        void *bytes = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            bytes = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd); // The mapping keeps the file open
+
+        if (bytes != MAP_FAILED) {
+            // We read front to back, so let the kernel read ahead aggressively.
+            // Only the start of the file is requested up front - asking for
+            // all of it would read every mapped video into the page cache on
+            // load, which for many large files is a lot of needless I/O.
+            #ifdef POSIX_MADV_SEQUENTIAL
+                size_t prefetch = (size_t)st.st_size < (1 << 20) ? (size_t)st.st_size : (1 << 20);
+                posix_madvise(bytes, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+                posix_madvise(bytes, prefetch, POSIX_MADV_WILLNEED);
+            #endif
+
+            plm_buffer_t *self = plm_buffer_create_with_memory((uint8_t *)bytes, (size_t)st.st_size, FALSE);
+            self->mode = PLM_BUFFER_MODE_MAPPED;
+            self->mapped_length = (size_t)st.st_size;
+            return self;
+        }
+    #endif
+
+    return plm_buffer_create_with_filename(filename);
+}
+
 plm_buffer_t *plm_buffer_create_with_file(FILE *fh, int close_when_done) {
     plm_buffer_t *self = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
     self->fh = fh;
@@ -1425,6 +1951,11 @@ void plm_buffer_destroy(plm_buffer_t *self) {
     if (self->free_when_done) {
         free(self->bytes);
     }
+    #ifdef PLM_MMAP
+        if (self->mode == PLM_BUFFER_MODE_MAPPED) {
+            munmap(self->bytes, self->mapped_length);
+        }
+    #endif
     free(self);
 }
 
@@ -1439,16 +1970,12 @@ size_t plm_buffer_get_remaining(plm_buffer_t *self) {
 }
 
 size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
-    if (self->mode == PLM_BUFFER_MODE_FIXED_MEM) {
+    if (self->mode == PLM_BUFFER_MODE_FIXED_MEM || self->mode == PLM_BUFFER_MODE_MAPPED) {
         return 0;
     }
 
     if (self->discard_read_bytes) {
-        // This should be a ring buffer, but instead it just shifts all unread 
-        // data to the beginning of the buffer and appends new data at the end. 
-        // Seems to be good enough.
-
-        plm_buffer_discard_read_bytes(self);
+        plm_buffer_make_room(self, length);
         if (self->mode == PLM_BUFFER_MODE_RING) {
             self->total_size = 0;
         }
@@ -1513,6 +2040,11 @@ size_t plm_buffer_tell(plm_buffer_t *self) {
 }
 
 void plm_buffer_discard_read_bytes(plm_buffer_t *self) {
+    // Memory buffers hold the whole file, and mapped ones are read-only
+    if (self->mode == PLM_BUFFER_MODE_FIXED_MEM || self->mode == PLM_BUFFER_MODE_MAPPED) {
+        return;
+    }
+
     size_t byte_pos = self->bit_index >> 3;
     if (byte_pos == self->length) {
         self->bit_index = 0;
@@ -1525,6 +2057,24 @@ void plm_buffer_discard_read_bytes(plm_buffer_t *self) {
     }
 }
 
+// Rather than shifting the unread data to the front of the buffer on every 
+// write, read bytes are only discarded once everything has been read or once
+// the end of the buffer can't fit length more bytes. Most writes then append
+// without moving anything.
+
+void plm_buffer_make_room(plm_buffer_t *self, size_t length) {
+    if (self->mode == PLM_BUFFER_MODE_FIXED_MEM || self->mode == PLM_BUFFER_MODE_MAPPED) {
+        return;
+    }
+
+    if (
+        (self->bit_index >> 3) == self->length ||
+        self->capacity - self->length < length
+    ) {
+        plm_buffer_discard_read_bytes(self);
+    }
+}
+
 void plm_buffer_load_file_callback(plm_buffer_t *self, void *user) {
     PLM_UNUSED(user);
     
@@ -1564,26 +2114,57 @@ int plm_buffer_has(plm_buffer_t *self, size_t count) {
     return FALSE;
 }
 
-int plm_buffer_read(plm_buffer_t *self, int count) {
-    if (!plm_buffer_has(self, count)) {
-        return 0;
+// The bit reader works on a 64 bit window loaded big endian from the current
+// byte. After shifting out the bits already read from that byte at least 57
+// valid bits remain, which covers every read and every VLC code. While 8 whole
+// bytes are left in the buffer the window is loaded without any further
+// bounds checks; only near the end do we fall back to plm_buffer_has() to
+// trigger the load callback. Bytes past the end of the buffer read as zero.
+
+static inline int plm_buffer_has_window(plm_buffer_t *self) {
+    return (self->bit_index >> 3) + 8 <= self->length;
+}
+
+static inline uint64_t plm_buffer_window(plm_buffer_t *self) {
+    size_t byte_index = self->bit_index >> 3;
+    const uint8_t *p = self->bytes + byte_index;
+    uint64_t window = 0;
+
+    if (byte_index + 8 <= self->length) {
+        window =
+            ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+            ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+            ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+            ((uint64_t)p[6] << 8) | ((uint64_t)p[7]);
+    }
+    else {
+        for (int i = 0; i < 8 && byte_index + i < self->length; i++) {
+            window |= (uint64_t)p[i] << (56 - (i << 3));
+        }
     }
+    return window << (self->bit_index & 7);
+}
 
-    int value = 0;
-    while (count) {
-        int current_byte = self->bytes[self->bit_index >> 3];
+int plm_buffer_peek(plm_buffer_t *self, int count) {
+    if (!plm_buffer_has_window(self)) {
+        plm_buffer_has(self, count);
+    }
 
-        int remaining = 8 - (self->bit_index & 7); // Remaining bits in byte
-        int read = remaining < count ? remaining : count; // Bits in self run
-        int shift = remaining - read;
-        int mask = (0xff >> (8 - read));
+    // Shift in two steps, so that a count of 0 yields 0
+    return (int)((plm_buffer_window(self) >> 1) >> (63 - count));
+}
 
-        value = (value << read) | ((current_byte & (mask << shift)) >> shift);
+void plm_buffer_consume(plm_buffer_t *self, int count) {
+    self->bit_index += count;
+}
 
-        self->bit_index += read;
-        count -= read;
+int plm_buffer_read(plm_buffer_t *self, int count) {
+    if (!plm_buffer_has_window(self) && !plm_buffer_has(self, count)) {
+        return 0;
     }
 
+    int value = (int)((plm_buffer_window(self) >> 1) >> (63 - count));
+    self->bit_index += count;
     return value;
 }
 
@@ -1653,13 +2234,27 @@ int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
         return FALSE;
     }
 
-    int val = plm_buffer_read(self, bit_count);
-    self->bit_index -= bit_count;
-    return val != 0;
+    return plm_buffer_peek(self, bit_count) != 0;
 }
 
 int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table) {
     plm_vlc_t state = {0, 0};
+
+    if (plm_buffer_has_window(self)) {
+        // Walk the tree over the window and consume all bits at once
+        uint64_t window = plm_buffer_window(self);
+        int count = 0;
+        do {
+            state = table[state.index + (int)(window >> 63)];
+            window <<= 1;
+            count++;
+        } while (state.index > 0);
+        plm_buffer_consume(self, count);
+        return state.value;
+    }
+
+    // Near the end of the buffer read bit by bit, so that the load callback
+    // is invoked and a truncated code reads as zeros
     do {
         state = table[state.index + plm_buffer_read(self, 1)];
     } while (state.index > 0);
@@ -1670,6 +2265,74 @@ uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *tabl
     return (uint16_t)plm_buffer_read_vlc(self, (const plm_vlc_t *)table);
 }
 
+int16_t plm_buffer_read_vlc_lut(plm_buffer_t *self, const plm_vlc_lut_t *lut) {
+    if (!plm_buffer_has_window(self)) {
+        return plm_buffer_read_vlc(self, lut->tree);
+    }
+
+    uint64_t window = plm_buffer_window(self);
+    int bits = lut->bits;
+    int offset = 0;
+    int count = 0;
+    while (TRUE) {
+        plm_vlc_lut_entry_t entry = lut->entries[offset + (int)(window >> (64 - bits))];
+        if (entry.length > 0) {
+            plm_buffer_consume(self, count + entry.length);
+            return entry.value;
+        }
+        window <<= bits;
+        count += bits;
+        offset = entry.value;
+        bits = -entry.length;
+    }
+}
+
+// Fill the table of 2^bits entries at offset for all codes starting at the
+// tree node, and append secondary tables for codes that are longer. Returns
+// the offset past the last table. With entries == NULL only the size is 
+// computed.
+
+static int plm_vlc_lut_build(
+    plm_vlc_lut_entry_t *entries, int offset, 
+    const plm_vlc_t *tree, int node, int bits, int sub_bits
+) {
+    int end = offset + (1 << bits);
+    for (int code = 0; code < (1 << bits); code++) {
+        plm_vlc_t state = {(int16_t)node, 0};
+        int length = 0;
+        do {
+            state = tree[state.index + ((code >> (bits - 1 - length)) & 1)];
+            length++;
+        } while (state.index > 0 && length < bits);
+
+        if (state.index > 0) {
+            if (entries) {
+                entries[offset + code].value = (int16_t)end;
+                entries[offset + code].length = (int16_t)-sub_bits;
+            }
+            end = plm_vlc_lut_build(entries, end, tree, state.index, sub_bits, sub_bits);
+        }
+        else if (entries) {
+            entries[offset + code].value = state.value;
+            entries[offset + code].length = (int16_t)length;
+        }
+    }
+    return end;
+}
+
+void plm_vlc_lut_init(plm_vlc_lut_t *self, const plm_vlc_t *tree, int bits, int sub_bits) {
+    int size = plm_vlc_lut_build(NULL, 0, tree, 0, bits, sub_bits);
+    self->tree = tree;
+    self->bits = bits;
+    self->entries = (plm_vlc_lut_entry_t *)malloc(size * sizeof(plm_vlc_lut_entry_t));
+    plm_vlc_lut_build(self->entries, 0, tree, 0, bits, sub_bits);
+}
+
+void plm_vlc_lut_free(plm_vlc_lut_t *self) {
+    free(self->entries);
+    self->entries = NULL;
+}
+
 
 
 // ----------------------------------------------------------------------------
@@ -1686,6 +2349,7 @@ typedef struct plm_demux_t {
 
     size_t last_file_size;
     double last_decoded_pts;
+    int probe_type;
     double start_time;
     double duration;
 
@@ -1698,10 +2362,16 @@ typedef struct plm_demux_t {
     int num_video_streams;
     plm_packet_t current_packet;
     plm_packet_t next_packet;
+
+    plm_demux_seek_index_entry_t *seek_index;
+    size_t seek_index_length;
+    size_t seek_index_capacity;
+    int seek_index_type;
 } plm_demux_t;
 
 
 void plm_demux_buffer_seek(plm_demux_t *self, size_t pos);
+int plm_demux_packet_has_intra_frame(plm_packet_t *packet);
 double plm_demux_decode_time(plm_demux_t *self);
 plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type);
 plm_packet_t *plm_demux_get_packet(plm_demux_t *self);
@@ -1725,6 +2395,7 @@ void plm_demux_destroy(plm_demux_t *self) {
     if (self->destroy_buffer_when_done) {
         plm_buffer_destroy(self->buffer);
     }
+    free(self->seek_index);
     free(self);
 }
 
@@ -1819,10 +2490,15 @@ void plm_demux_buffer_seek(plm_demux_t *self, size_t pos) {
 }
 
 double plm_demux_get_start_time(plm_demux_t *self, int type) {
-    if (self->start_time != PLM_PACKET_INVALID_TS) {
+    if (self->start_time != PLM_PACKET_INVALID_TS && self->probe_type == type) {
         return self->start_time;
     }
 
+    // Probing another type invalidates the cached duration as well
+    self->probe_type = type;
+    self->start_time = PLM_PACKET_INVALID_TS;
+    self->duration = PLM_PACKET_INVALID_TS;
+
     int previous_pos = plm_buffer_tell(self->buffer);
     int previous_start_code = self->start_code;
     
@@ -1848,7 +2524,8 @@ double plm_demux_get_duration(plm_demux_t *self, int type) {
 
     if (
         self->duration != PLM_PACKET_INVALID_TS &&
-        self->last_file_size == file_size
+        self->last_file_size == file_size &&
+        self->probe_type == type
     ) {
         return self->duration;
     }
@@ -1856,9 +2533,10 @@ double plm_demux_get_duration(plm_demux_t *self, int type) {
     size_t previous_pos = plm_buffer_tell(self->buffer);
     int previous_start_code = self->start_code;
     
-    // Find last video PTS. Start searching 64kb from the end and go further 
-    // back if needed.
-    long start_range = 64 * 1024;
+    // Find last video PTS. Start searching 16kb from the end - that's a few
+    // packs, which almost always include a packet of this type - and go 
+    // further back if needed.
+    long start_range = 16 * 1024;
     long max_range = 4096 * 1024;
     for (long range = start_range; range <= max_range; range *= 2) {
         long seek_pos = file_size - range;
@@ -1888,6 +2566,22 @@ double plm_demux_get_duration(plm_demux_t *self, int type) {
     return self->duration;
 }
 
+int plm_demux_get_probe(plm_demux_t *self, int type, plm_demux_probe_t *probe) {
+    probe->type = type;
+    probe->start_time = plm_demux_get_start_time(self, type);
+    probe->duration = plm_demux_get_duration(self, type);
+    return 
+        probe->start_time != PLM_PACKET_INVALID_TS &&
+        probe->duration != PLM_PACKET_INVALID_TS;
+}
+
+void plm_demux_set_probe(plm_demux_t *self, const plm_demux_probe_t *probe) {
+    self->probe_type = probe->type;
+    self->start_time = probe->start_time;
+    self->duration = probe->duration;
+    self->last_file_size = plm_buffer_get_size(self->buffer);
+}
+
 plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int force_intra) {
     if (!plm_demux_has_headers(self)) {
         return NULL;
@@ -1924,6 +2618,24 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
     }
     seek_time += self->start_time;
 
+    // With an index, find the last intra frame before seek_time directly. If 
+    // seek_time is before the first one, use that.
+    if (force_intra && self->seek_index_length && self->seek_index_type == type) {
+        size_t lo = 0;
+        size_t hi = self->seek_index_length;
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (self->seek_index[mid].pts <= seek_time) {
+                lo = mid;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        plm_demux_buffer_seek(self, self->seek_index[lo].pos);
+        return plm_demux_decode_packet(self, type);
+    }
+
     for (int retry = 0; retry < 32; retry++) {
         int found_packet_with_pts = FALSE;
         int found_packet_in_range = FALSE;
@@ -1981,21 +2693,8 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
             // later, when we know it's the last intra frame before desired
             // seek time.
             if (force_intra) {
-                for (size_t i = 0; i < packet->length - 6; i++) {
-                    // Find the START_PICTURE code
-                    if (
-                        packet->data[i] == 0x00 &&
-                        packet->data[i + 1] == 0x00 &&
-                        packet->data[i + 2] == 0x01 &&
-                        packet->data[i + 3] == 0x00
-                    ) {
-                        // Bits 11--13 in the picture header contain the frame 
-                        // type, where 1=Intra
-                        if ((packet->data[i + 5] & 0x38) == 8) {
-                            last_valid_packet_start = packet_start;
-                        }
-                        break;
-                    }
+                if (plm_demux_packet_has_intra_frame(packet)) {
+                    last_valid_packet_start = packet_start;
                 }
             }
 
@@ -2031,6 +2730,90 @@ plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int
     return NULL;
 }
 
+int plm_demux_packet_has_intra_frame(plm_packet_t *packet) {
+    for (size_t i = 0; i < packet->length - 6; i++) {
+        // Find the START_PICTURE code
+        if (
+            packet->data[i] == 0x00 &&
+            packet->data[i + 1] == 0x00 &&
+            packet->data[i + 2] == 0x01 &&
+            packet->data[i + 3] == 0x00
+        ) {
+            // Bits 11--13 in the picture header contain the frame type, where
+            // 1=Intra
+            return (packet->data[i + 5] & 0x38) == 8;
+        }
+    }
+    return FALSE;
+}
+
+int plm_demux_build_seek_index(plm_demux_t *self, int type) {
+    if (!plm_demux_has_headers(self)) {
+        return FALSE;
+    }
+
+    size_t previous_pos = plm_buffer_tell(self->buffer);
+    int previous_start_code = self->start_code;
+
+    self->seek_index_length = 0;
+    self->seek_index_type = type;
+
+    // Collect the start of every packet with a PTS that contains an intra 
+    // frame, the same way plm_demux_seek() does when scanning
+    plm_demux_rewind(self);
+    while (plm_buffer_find_start_code(self->buffer, type) != -1) {
+        size_t packet_start = plm_buffer_tell(self->buffer);
+        plm_packet_t *packet = plm_demux_decode_packet(self, type);
+        if (
+            !packet || packet->pts == PLM_PACKET_INVALID_TS ||
+            !plm_demux_packet_has_intra_frame(packet)
+        ) {
+            continue;
+        }
+
+        if (self->seek_index_length == self->seek_index_capacity) {
+            self->seek_index_capacity = self->seek_index_capacity
+                ? self->seek_index_capacity * 2
+                : 256;
+            self->seek_index = (plm_demux_seek_index_entry_t *)realloc(
+                self->seek_index, 
+                self->seek_index_capacity * sizeof(plm_demux_seek_index_entry_t)
+            );
+        }
+        self->seek_index[self->seek_index_length].pts = packet->pts;
+        self->seek_index[self->seek_index_length].pos = packet_start;
+        self->seek_index_length++;
+    }
+
+    plm_demux_buffer_seek(self, previous_pos);
+    self->start_code = previous_start_code;
+    return self->seek_index_length > 0;
+}
+
+int plm_demux_has_seek_index(plm_demux_t *self) {
+    return self->seek_index_length > 0;
+}
+
+const plm_demux_seek_index_entry_t *plm_demux_get_seek_index(plm_demux_t *self, size_t *length) {
+    *length = self->seek_index_length;
+    return self->seek_index_length ? self->seek_index : NULL;
+}
+
+void plm_demux_set_seek_index(plm_demux_t *self, int type, const plm_demux_seek_index_entry_t *entries, size_t length) {
+    if (length > self->seek_index_capacity) {
+        self->seek_index_capacity = length;
+        self->seek_index = (plm_demux_seek_index_entry_t *)realloc(
+            self->seek_index, 
+            self->seek_index_capacity * sizeof(plm_demux_seek_index_entry_t)
+        );
+    }
+    if (length) {
+        memcpy(self->seek_index, entries, length * sizeof(plm_demux_seek_index_entry_t));
+    }
+    self->seek_index_length = length;
+    self->seek_index_type = type;
+}
+
 plm_packet_t *plm_demux_decode(plm_demux_t *self) {
     if (!plm_demux_has_headers(self)) {
         return NULL;
@@ -2549,6 +3332,12 @@ typedef struct {
     int v;
 } plm_video_motion_t;
 
+typedef struct {
+    size_t byte_index;
+    int slice;
+    plm_video_block_stats_t block_stats;
+} plm_video_slice_t;
+
 typedef struct plm_video_t {
     double framerate;
     double time;
@@ -2600,6 +3389,22 @@ typedef struct plm_video_t {
 
     int has_reference_frame;
     int assume_no_b_frames;
+    int skip_b_frames;
+    int skipped_picture;
+
+    void (*idct)(int *block);
+    void (*idct_4x4)(int *block);
+    plm_video_block_stats_t block_stats;
+
+    plm_vlc_lut_t macroblock_address_increment_lut;
+    plm_vlc_lut_t code_block_pattern_lut;
+    plm_vlc_lut_t dct_coeff_lut;
+
+    plm_video_slice_callback slice_callback;
+    void *slice_callback_user_data;
+    plm_video_slice_t *slices;
+    int slices_count;
+    int slices_capacity;
 } plm_video_t;
 
 static inline uint8_t plm_clamp(int n) {
@@ -2615,6 +3420,7 @@ static inline uint8_t plm_clamp(int n) {
 int plm_video_decode_sequence_header(plm_video_t *self);
 void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base);
 void plm_video_decode_picture(plm_video_t *self);
+int plm_video_find_slices(plm_video_t *self);
 void plm_video_decode_slice(plm_video_t *self, int slice);
 void plm_video_decode_macroblock(plm_video_t *self);
 void plm_video_decode_motion_vectors(plm_video_t *self);
@@ -2625,6 +3431,8 @@ void plm_video_interpolate_macroblock(plm_video_t *self, plm_frame_t *s, int mot
 void plm_video_process_macroblock(plm_video_t *self, uint8_t *s, uint8_t *d, int mh, int mb, int bs, int interp);
 void plm_video_decode_block(plm_video_t *self, int block);
 void plm_video_idct(int *block);
+void plm_video_idct_4x4(int *block);
+void plm_video_select_idct(plm_video_t *self);
 
 plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
     plm_video_t *self = (plm_video_t *)malloc(sizeof(plm_video_t));
@@ -2632,6 +3440,13 @@ plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_whe
     
     self->buffer = buffer;
     self->destroy_buffer_when_done = destroy_when_done;
+    plm_video_select_idct(self);
+
+    // Compile the hottest VLC trees into tables. No code is longer than 16 
+    // bits, so every lookup takes at most two steps.
+    plm_vlc_lut_init(&self->macroblock_address_increment_lut, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT, 8, 3);
+    plm_vlc_lut_init(&self->code_block_pattern_lut, PLM_VIDEO_CODE_BLOCK_PATTERN, 9, 3);
+    plm_vlc_lut_init(&self->dct_coeff_lut, (const plm_vlc_t *)PLM_VIDEO_DCT_COEFF, 10, 6);
 
     // Attempt to decode the sequence header
     self->start_code = plm_buffer_find_start_code(self->buffer, PLM_START_SEQUENCE);
@@ -2650,6 +3465,11 @@ void plm_video_destroy(plm_video_t *self) {
         free(self->frames_data);
     }
 
+    plm_vlc_lut_free(&self->macroblock_address_increment_lut);
+    plm_vlc_lut_free(&self->code_block_pattern_lut);
+    plm_vlc_lut_free(&self->dct_coeff_lut);
+
+    free(self->slices);
     free(self);
 }
 
@@ -2675,6 +3495,19 @@ void plm_video_set_no_delay(plm_video_t *self, int no_delay) {
     self->assume_no_b_frames = no_delay;
 }
 
+void plm_video_set_skip_b_frames(plm_video_t *self, int skip) {
+    self->skip_b_frames = skip;
+}
+
+void plm_video_set_slice_callback(plm_video_t *self, plm_video_slice_callback fp, void *user) {
+    self->slice_callback = fp;
+    self->slice_callback_user_data = user;
+}
+
+plm_video_block_stats_t plm_video_get_block_stats(plm_video_t *self) {
+    return self->block_stats;
+}
+
 double plm_video_get_time(plm_video_t *self) {
     return self->time;
 }
@@ -2737,7 +3570,7 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
         ) {
             return NULL;
         }
-        plm_buffer_discard_read_bytes(self->buffer);
+        plm_buffer_make_room(self->buffer, self->buffer->capacity / 2);
         
         plm_video_decode_picture(self);
 
@@ -2745,7 +3578,10 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
             frame = &self->frame_backward;
         }
         else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
-            frame = &self->frame_current;
+            // frame_forward is the reference shown just before this B-frame
+            frame = self->skipped_picture
+                ? &self->frame_forward
+                : &self->frame_current;
         }
         else if (self->has_reference_frame) {
             frame = &self->frame_forward;
@@ -2869,6 +3705,7 @@ void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base)
 }
 
 void plm_video_decode_picture(plm_video_t *self) {
+    self->skipped_picture = FALSE;
     plm_buffer_skip(self->buffer, 10); // skip temporalReference
     self->picture_type = plm_buffer_read(self->buffer, 3);
     plm_buffer_skip(self->buffer, 16); // skip vbv_delay
@@ -2901,6 +3738,14 @@ void plm_video_decode_picture(plm_video_t *self) {
             return;
         }
         self->motion_backward.r_size = f_code - 1;
+
+        // Nothing references a B-frame, so we can skip straight to the start
+        // code of the next picture without decoding any of its slices
+        if (self->skip_b_frames) {
+            self->skipped_picture = TRUE;
+            self->start_code = -1;
+            return;
+        }
     }
 
     plm_frame_t frame_temp = self->frame_forward;
@@ -2920,13 +3765,25 @@ void plm_video_decode_picture(plm_video_t *self) {
         self->start_code == PLM_START_USER_DATA
     );
 
-    // Decode all slices
-    while (PLM_START_IS_SLICE(self->start_code)) {
-        plm_video_decode_slice(self, self->start_code & 0x000000FF);
-        if (self->macroblock_address >= self->mb_size - 2) {
-            break;
+    // Decode all slices, concurrently if we can
+    if (self->slice_callback && plm_video_find_slices(self)) {
+        self->slice_callback(self, self->slices_count, self->slice_callback_user_data);
+
+        for (int i = 0; i < self->slices_count; i++) {
+            plm_video_block_stats_t *stats = &self->slices[i].block_stats;
+            self->block_stats.dc_only += stats->dc_only;
+            self->block_stats.sparse += stats->sparse;
+            self->block_stats.full += stats->full;
+        }
+    }
+    else {
+        while (PLM_START_IS_SLICE(self->start_code)) {
+            plm_video_decode_slice(self, self->start_code & 0x000000FF);
+            if (self->macroblock_address >= self->mb_size - 2) {
+                break;
+            }
+            self->start_code = plm_buffer_next_start_code(self->buffer);
         }
-        self->start_code = plm_buffer_next_start_code(self->buffer);
     }
 
     // If this is a reference picture rotate the prediction pointers
@@ -2939,6 +3796,78 @@ void plm_video_decode_picture(plm_video_t *self) {
     }
 }
 
+int plm_video_find_slices(plm_video_t *self) {
+    // Collect the position of every slice in the picture. The buffer must not
+    // discard any bytes while we do this, or the positions would be invalid
+    // by the time the slices are decoded.
+    size_t previous_bit_index = self->buffer->bit_index;
+    int previous_start_code = self->start_code;
+    int previous_discard_read_bytes = self->buffer->discard_read_bytes;
+    self->buffer->discard_read_bytes = FALSE;
+
+    int in_order = TRUE;
+    self->slices_count = 0;
+    while (PLM_START_IS_SLICE(self->start_code)) {
+        int slice = self->start_code & 0x000000FF;
+        if (
+            self->slices_count > 0 &&
+            slice < self->slices[self->slices_count - 1].slice
+        ) {
+            // Slices out of order may overlap; only safe to decode serially
+            in_order = FALSE;
+            break;
+        }
+
+        if (self->slices_count == self->slices_capacity) {
+            self->slices_capacity = self->slices_capacity
+                ? self->slices_capacity * 2
+                : self->mb_height;
+            self->slices = (plm_video_slice_t *)realloc(
+                self->slices, self->slices_capacity * sizeof(plm_video_slice_t)
+            );
+        }
+        self->slices[self->slices_count].byte_index = self->buffer->bit_index >> 3;
+        self->slices[self->slices_count].slice = slice;
+        self->slices_count++;
+
+        self->start_code = plm_buffer_next_start_code(self->buffer);
+    }
+
+    self->buffer->discard_read_bytes = previous_discard_read_bytes;
+
+    if (!in_order || self->slices_count < 2) {
+        self->buffer->bit_index = previous_bit_index;
+        self->start_code = previous_start_code;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void plm_video_decode_slice_job(plm_video_t *self, int index) {
+    // Each slice gets its own copy of the decoder state with a bit reader 
+    // that starts at the slice. The copy shares the frame planes, but slices
+    // never write to the same macroblocks.
+    plm_video_slice_t *job = &self->slices[index];
+    plm_buffer_t buffer = *self->buffer;
+    buffer.bytes += job->byte_index;
+    buffer.length -= job->byte_index;
+    buffer.capacity = buffer.length;
+    buffer.total_size = buffer.length;
+    buffer.bit_index = 0;
+    buffer.load_callback = NULL;
+    buffer.fh = NULL;
+    buffer.mode = PLM_BUFFER_MODE_FIXED_MEM;
+
+    plm_video_t context = *self;
+    context.buffer = &buffer;
+    memset(context.block_data, 0, sizeof(context.block_data));
+    memset(&context.block_stats, 0, sizeof(context.block_stats));
+    plm_video_decode_slice(&context, job->slice);
+
+    // Counted separately, then summed once all slices are done
+    job->block_stats = context.block_stats;
+}
+
 void plm_video_decode_slice(plm_video_t *self, int slice) {
     self->slice_begin = TRUE;
     self->macroblock_address = (slice - 1) * self->mb_width - 1;
@@ -2968,16 +3897,16 @@ void plm_video_decode_slice(plm_video_t *self, int slice) {
 void plm_video_decode_macroblock(plm_video_t *self) {
     // Decode increment
     int increment = 0;
-    int t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+    int t = plm_buffer_read_vlc_lut(self->buffer, &self->macroblock_address_increment_lut);
 
     while (t == 34) {
         // macroblock_stuffing
-        t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+        t = plm_buffer_read_vlc_lut(self->buffer, &self->macroblock_address_increment_lut);
     }
     while (t == 35) {
         // macroblock_escape
         increment += 33;
-        t = plm_buffer_read_vlc(self->buffer, PLM_VIDEO_MACROBLOCK_ADDRESS_INCREMENT);
+        t = plm_buffer_read_vlc_lut(self->buffer, &self->macroblock_address_increment_lut);
     }
     increment += t;
 
@@ -3054,7 +3983,7 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 
     // Decode blocks
     int cbp = ((self->macroblock_type & 0x02) != 0)
-        ? plm_buffer_read_vlc(self->buffer, PLM_VIDEO_CODE_BLOCK_PATTERN)
+        ? plm_buffer_read_vlc_lut(self->buffer, &self->code_block_pattern_lut)
         : (self->macroblock_intra ? 0x3f : 0);
 
     for (int block = 0, mask = 0x20; block < 6; block++) {
@@ -3173,6 +4102,90 @@ void plm_video_interpolate_macroblock(plm_video_t *self, plm_frame_t *s, int mot
         DEST_INDEX += dest_scan; \
     }} while(FALSE)
 
+// SIMD motion compensation. Half-pel and bidirectional averages are the
+// rounding byte average, (a + b + 1) >> 1, which SSE2 and NEON have as single
+// instructions. The 4-way average for diagonal half-pel is widened to 16bit.
+// Rows are loaded 8 or 16 bytes at a time, so this reads exactly the bytes
+// the scalar version does.
+
+#define PLM_DEFINE_MACROBLOCK_FUNCTION(NAME, BLOCK_SIZE, T, LOAD, STORE, AVG, AVG4) \
+    static void NAME(const uint8_t *s, uint8_t *d, int dw, int odd_h, int odd_v, int interpolate) { \
+        for (int y = 0; y < BLOCK_SIZE; y++) { \
+            T v = LOAD(s); \
+            if (odd_h && odd_v) { \
+                v = AVG4(v, LOAD(s + 1), LOAD(s + dw), LOAD(s + dw + 1)); \
+            } \
+            else if (odd_h) { \
+                v = AVG(v, LOAD(s + 1)); \
+            } \
+            else if (odd_v) { \
+                v = AVG(v, LOAD(s + dw)); \
+            } \
+            if (interpolate) { \
+                v = AVG(LOAD(d), v); \
+            } \
+            STORE(d, v); \
+            s += dw; \
+            d += dw; \
+        } \
+    }
+
+#if defined(PLM_SIMD_SSE2)
+
+static inline __m128i plm_video_avg4_sse2(__m128i a, __m128i b, __m128i c, __m128i d) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i two = _mm_set1_epi16(2);
+    __m128i lo = _mm_add_epi16(
+        _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+        _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero))
+    );
+    __m128i hi = _mm_add_epi16(
+        _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+        _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero))
+    );
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    return _mm_packus_epi16(lo, hi);
+}
+
+#define PLM_SSE2_LOAD16(P) _mm_loadu_si128((const __m128i *)(P))
+#define PLM_SSE2_STORE16(P, V) _mm_storeu_si128((__m128i *)(P), V)
+#define PLM_SSE2_LOAD8(P) _mm_loadl_epi64((const __m128i *)(P))
+#define PLM_SSE2_STORE8(P, V) _mm_storel_epi64((__m128i *)(P), V)
+
+PLM_DEFINE_MACROBLOCK_FUNCTION(
+    plm_video_process_macroblock_16, 16, __m128i, PLM_SSE2_LOAD16, PLM_SSE2_STORE16,
+    _mm_avg_epu8, plm_video_avg4_sse2
+)
+PLM_DEFINE_MACROBLOCK_FUNCTION(
+    plm_video_process_macroblock_8, 8, __m128i, PLM_SSE2_LOAD8, PLM_SSE2_STORE8,
+    _mm_avg_epu8, plm_video_avg4_sse2
+)
+
+#elif defined(PLM_SIMD_NEON)
+
+static inline uint8x8_t plm_video_avg4_neon(uint8x8_t a, uint8x8_t b, uint8x8_t c, uint8x8_t d) {
+    return vrshrn_n_u16(vaddq_u16(vaddl_u8(a, b), vaddl_u8(c, d)), 2);
+}
+
+static inline uint8x16_t plm_video_avg4q_neon(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d) {
+    return vcombine_u8(
+        plm_video_avg4_neon(vget_low_u8(a), vget_low_u8(b), vget_low_u8(c), vget_low_u8(d)),
+        plm_video_avg4_neon(vget_high_u8(a), vget_high_u8(b), vget_high_u8(c), vget_high_u8(d))
+    );
+}
+
+PLM_DEFINE_MACROBLOCK_FUNCTION(
+    plm_video_process_macroblock_16, 16, uint8x16_t, vld1q_u8, vst1q_u8,
+    vrhaddq_u8, plm_video_avg4q_neon
+)
+PLM_DEFINE_MACROBLOCK_FUNCTION(
+    plm_video_process_macroblock_8, 8, uint8x8_t, vld1_u8, vst1_u8,
+    vrhadd_u8, plm_video_avg4_neon
+)
+
+#endif
+
 void plm_video_process_macroblock(
     plm_video_t *self, uint8_t *s, uint8_t *d,
     int motion_h, int motion_v, int block_size, int interpolate
@@ -3192,6 +4205,14 @@ void plm_video_process_macroblock(
         return; // corrupt video
     }
 
+#if defined(PLM_SIMD_SSE2) || defined(PLM_SIMD_NEON)
+    if (block_size == 16) {
+        plm_video_process_macroblock_16(s + si, d + di, dw, odd_h, odd_v, interpolate);
+    }
+    else {
+        plm_video_process_macroblock_8(s + si, d + di, dw, odd_h, odd_v, interpolate);
+    }
+#else
     #define PLM_MB_CASE(INTERPOLATE, ODD_H, ODD_V, OP) \
         case ((INTERPOLATE << 2) | (ODD_H << 1) | (ODD_V)): \
             PLM_BLOCK_SET(d, di, dw, si, dw, block_size, OP); \
@@ -3210,6 +4231,7 @@ void plm_video_process_macroblock(
     }
 
     #undef PLM_MB_CASE
+#endif
 }
 
 void plm_video_decode_block(plm_video_t *self, int block) {
@@ -3254,11 +4276,13 @@ void plm_video_decode_block(plm_video_t *self, int block) {
         quant_matrix = self->non_intra_quant_matrix;
     }
 
-    // Decode AC coefficients (+DC for non-intra)
+    // Decode AC coefficients (+DC for non-intra). The coefficient positions are
+    // OR'ed together to find out whether they all fall into the top-left 4x4.
     int level = 0;
+    int coeff_mask = 0;
     while (TRUE) {
         int run = 0;
-        uint16_t coeff = plm_buffer_read_vlc_uint(self->buffer, PLM_VIDEO_DCT_COEFF);
+        uint16_t coeff = (uint16_t)plm_buffer_read_vlc_lut(self->buffer, &self->dct_coeff_lut);
 
         if ((coeff == 0x0001) && (n > 0) && (plm_buffer_read(self->buffer, 1) == 0)) {
             // end_of_block
@@ -3292,6 +4316,7 @@ void plm_video_decode_block(plm_video_t *self, int block) {
         }
 
         int de_zig_zagged = PLM_VIDEO_ZIG_ZAG[n];
+        coeff_mask |= de_zig_zagged;
         n++;
 
         // Dequantize, oddify, clip
@@ -3338,32 +4363,43 @@ void plm_video_decode_block(plm_video_t *self, int block) {
 
     int *s = self->block_data;
     int si = 0;
-    if (self->macroblock_intra) {
-        // Overwrite (no prediction)
-        if (n == 1) {
+
+    // Only a DC coefficient; the IDCT of that is a constant
+    if (n == 1) {
+        self->block_stats.dc_only++;
+        if (self->macroblock_intra) {
+            // Overwrite (no prediction)
             int clamped = plm_clamp((s[0] + 128) >> 8);
             PLM_BLOCK_SET(d, di, dw, si, 8, 8, clamped);
-            s[0] = 0;
         }
         else {
-            plm_video_idct(s);
-            PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(s[si]));
-            memset(self->block_data, 0, sizeof(self->block_data));
+            // Add data to the predicted macroblock
+            int value = (s[0] + 128) >> 8;
+            PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + value));
         }
+        s[0] = 0;
+        return;
+    }
+
+    // Row and column 4 are bits 5 and 2 of the position
+    if ((coeff_mask & 0x24) == 0) {
+        self->block_stats.sparse++;
+        self->idct_4x4(s);
+    }
+    else {
+        self->block_stats.full++;
+        self->idct(s);
+    }
+
+    if (self->macroblock_intra) {
+        // Overwrite (no prediction)
+        PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(s[si]));
     }
     else {
         // Add data to the predicted macroblock
-        if (n == 1) {
-            int value = (s[0] + 128) >> 8;
-            PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + value));
-            s[0] = 0;
-        }
-        else {
-            plm_video_idct(s);
-            PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + s[si]));
-            memset(self->block_data, 0, sizeof(self->block_data));
-        }
+        PLM_BLOCK_SET(d, di, dw, si, 8, 8, plm_clamp(d[di] + s[si]));
     }
+    memset(self->block_data, 0, sizeof(self->block_data));
 }
 
 void plm_video_idct(int *block) {
@@ -3432,52 +4468,847 @@ void plm_video_idct(int *block) {
     }
 }
 
+// The butterfly of plm_video_idct(), shared by the reduced and SIMD IDCTs 
+// below. The SIMD versions run it on several columns (then rows) at once. 
+// Lanes are 32bit and wrap around just like int, so the results are bit-exact
+// with the scalar version.
+
+#define PLM_VIDEO_IDCT_BUTTERFLY(T, e, ADD, SUB, MUL, ROUND, ZERO) do { \
+    T b1 = e[4]; \
+    T b3 = ADD(e[2], e[6]); \
+    T b4 = SUB(e[5], e[3]); \
+    T tmp1 = ADD(e[1], e[7]); \
+    T tmp2 = ADD(e[3], e[5]); \
+    T b6 = SUB(e[1], e[7]); \
+    T b7 = ADD(tmp1, tmp2); \
+    T m0 = e[0]; \
+    T x4 = SUB(ROUND(SUB(MUL(b6, 473), MUL(b4, 196))), b7); \
+    T x0 = SUB(x4, ROUND(MUL(SUB(tmp1, tmp2), 362))); \
+    T x1 = SUB(m0, b1); \
+    T x2 = SUB(ROUND(MUL(SUB(e[2], e[6]), 362)), b3); \
+    T x3 = ADD(m0, b1); \
+    T y3 = ADD(x1, x2); \
+    T y4 = ADD(x3, b3); \
+    T y5 = SUB(x1, x2); \
+    T y6 = SUB(x3, b3); \
+    T y7 = SUB(SUB(ZERO, x0), ROUND(ADD(MUL(b4, 473), MUL(b6, 196)))); \
+    e[0] = ADD(b7, y4); \
+    e[1] = ADD(x4, y3); \
+    e[2] = SUB(y5, x0); \
+    e[3] = SUB(y6, y7); \
+    e[4] = ADD(y6, y7); \
+    e[5] = ADD(x0, y5); \
+    e[6] = SUB(y3, x4); \
+    e[7] = SUB(y4, b7); \
+    } while(FALSE)
+
+// plm_video_idct() for blocks whose coefficients all lie in the top-left 4x4.
+// Only four columns need transforming, and then only the left half of each
+// row is non-zero; the zeros fold away but the arithmetic is unchanged.
+
+#define PLM_INT_ADD(A, B) ((A) + (B))
+#define PLM_INT_SUB(A, B) ((A) - (B))
+#define PLM_INT_MUL(A, K) ((A) * (K))
+#define PLM_INT_ROUND(A) (((A) + 128) >> 8)
+
+void plm_video_idct_4x4(int *block) {
+    int e[8];
+
+    // Transform columns
+    for (int i = 0; i < 4; ++i) {
+        e[0] = block[0 * 8 + i];
+        e[1] = block[1 * 8 + i];
+        e[2] = block[2 * 8 + i];
+        e[3] = block[3 * 8 + i];
+        e[4] = e[5] = e[6] = e[7] = 0;
+        PLM_VIDEO_IDCT_BUTTERFLY(int, e, PLM_INT_ADD, PLM_INT_SUB, PLM_INT_MUL, PLM_INT_ROUND, 0);
+        block[0 * 8 + i] = e[0];
+        block[1 * 8 + i] = e[1];
+        block[2 * 8 + i] = e[2];
+        block[3 * 8 + i] = e[3];
+        block[4 * 8 + i] = e[4];
+        block[5 * 8 + i] = e[5];
+        block[6 * 8 + i] = e[6];
+        block[7 * 8 + i] = e[7];
+    }
+
+    // Transform rows
+    for (int i = 0; i < 64; i += 8) {
+        e[0] = block[0 + i];
+        e[1] = block[1 + i];
+        e[2] = block[2 + i];
+        e[3] = block[3 + i];
+        e[4] = e[5] = e[6] = e[7] = 0;
+        PLM_VIDEO_IDCT_BUTTERFLY(int, e, PLM_INT_ADD, PLM_INT_SUB, PLM_INT_MUL, PLM_INT_ROUND, 0);
+        block[0 + i] = PLM_INT_ROUND(e[0]);
+        block[1 + i] = PLM_INT_ROUND(e[1]);
+        block[2 + i] = PLM_INT_ROUND(e[2]);
+        block[3 + i] = PLM_INT_ROUND(e[3]);
+        block[4 + i] = PLM_INT_ROUND(e[4]);
+        block[5 + i] = PLM_INT_ROUND(e[5]);
+        block[6 + i] = PLM_INT_ROUND(e[6]);
+        block[7 + i] = PLM_INT_ROUND(e[7]);
+    }
+}
+
+// 4 lane version; the columns are done in two halves and the rows in two 
+// sets of four, transposing 4x4 tiles so that lanes hold rows instead. The
+// loads and stores are spelled out so that e[] stays in registers. The _4x4
+// variant skips the right half of the columns, which is all zeros and stays
+// that way, and then only has the left half of each row to transpose.
+
+#define PLM_DEFINE_VIDEO_IDCT4_FUNCTION(NAME, T, LOAD, STORE, ADD, SUB, MUL, ROUND, ZERO, TRANSPOSE) \
+    static inline void NAME##_columns(int *b) { \
+        T e[8]; \
+        e[0] = LOAD(b +  0); e[1] = LOAD(b +  8); e[2] = LOAD(b + 16); e[3] = LOAD(b + 24); \
+        e[4] = LOAD(b + 32); e[5] = LOAD(b + 40); e[6] = LOAD(b + 48); e[7] = LOAD(b + 56); \
+        PLM_VIDEO_IDCT_BUTTERFLY(T, e, ADD, SUB, MUL, ROUND, ZERO); \
+        STORE(b +  0, e[0]); STORE(b +  8, e[1]); STORE(b + 16, e[2]); STORE(b + 24, e[3]); \
+        STORE(b + 32, e[4]); STORE(b + 40, e[5]); STORE(b + 48, e[6]); STORE(b + 56, e[7]); \
+    } \
+    static inline void NAME##_rows(int *b) { \
+        T e[8]; \
+        e[0] = LOAD(b +  0); e[1] = LOAD(b +  8); e[2] = LOAD(b + 16); e[3] = LOAD(b + 24); \
+        e[4] = LOAD(b +  4); e[5] = LOAD(b + 12); e[6] = LOAD(b + 20); e[7] = LOAD(b + 28); \
+        TRANSPOSE(e[0], e[1], e[2], e[3]); \
+        TRANSPOSE(e[4], e[5], e[6], e[7]); \
+        PLM_VIDEO_IDCT_BUTTERFLY(T, e, ADD, SUB, MUL, ROUND, ZERO); \
+        e[0] = ROUND(e[0]); e[1] = ROUND(e[1]); e[2] = ROUND(e[2]); e[3] = ROUND(e[3]); \
+        e[4] = ROUND(e[4]); e[5] = ROUND(e[5]); e[6] = ROUND(e[6]); e[7] = ROUND(e[7]); \
+        TRANSPOSE(e[0], e[1], e[2], e[3]); \
+        TRANSPOSE(e[4], e[5], e[6], e[7]); \
+        STORE(b +  0, e[0]); STORE(b +  8, e[1]); STORE(b + 16, e[2]); STORE(b + 24, e[3]); \
+        STORE(b +  4, e[4]); STORE(b + 12, e[5]); STORE(b + 20, e[6]); STORE(b + 28, e[7]); \
+    } \
+    void NAME(int *block) { \
+        NAME##_columns(block); \
+        NAME##_columns(block + 4); \
+        NAME##_rows(block); \
+        NAME##_rows(block + 32); \
+    } \
+    static inline void NAME##_rows_4x4(int *b) { \
+        T e[8]; \
+        e[0] = LOAD(b +  0); e[1] = LOAD(b +  8); e[2] = LOAD(b + 16); e[3] = LOAD(b + 24); \
+        TRANSPOSE(e[0], e[1], e[2], e[3]); \
+        e[4] = e[5] = e[6] = e[7] = ZERO; \
+        PLM_VIDEO_IDCT_BUTTERFLY(T, e, ADD, SUB, MUL, ROUND, ZERO); \
+        e[0] = ROUND(e[0]); e[1] = ROUND(e[1]); e[2] = ROUND(e[2]); e[3] = ROUND(e[3]); \
+        e[4] = ROUND(e[4]); e[5] = ROUND(e[5]); e[6] = ROUND(e[6]); e[7] = ROUND(e[7]); \
+        TRANSPOSE(e[0], e[1], e[2], e[3]); \
+        TRANSPOSE(e[4], e[5], e[6], e[7]); \
+        STORE(b +  0, e[0]); STORE(b +  8, e[1]); STORE(b + 16, e[2]); STORE(b + 24, e[3]); \
+        STORE(b +  4, e[4]); STORE(b + 12, e[5]); STORE(b + 20, e[6]); STORE(b + 28, e[7]); \
+    } \
+    void NAME##_4x4(int *block) { \
+        T e[8]; \
+        e[0] = LOAD(block +  0); e[1] = LOAD(block +  8); \
+        e[2] = LOAD(block + 16); e[3] = LOAD(block + 24); \
+        e[4] = e[5] = e[6] = e[7] = ZERO; \
+        PLM_VIDEO_IDCT_BUTTERFLY(T, e, ADD, SUB, MUL, ROUND, ZERO); \
+        STORE(block +  0, e[0]); STORE(block +  8, e[1]); STORE(block + 16, e[2]); STORE(block + 24, e[3]); \
+        STORE(block + 32, e[4]); STORE(block + 40, e[5]); STORE(block + 48, e[6]); STORE(block + 56, e[7]); \
+        NAME##_rows_4x4(block); \
+        NAME##_rows_4x4(block + 32); \
+    }
+
+#ifdef PLM_SIMD_SSE2
+
+// SSE2 has no 32bit multiply-low. With a 16bit constant it can be built from
+// 16bit multiplies: a * k = lo(a) * k + ((hi(a) * k) << 16), modulo 2^32.
+static inline __m128i plm_video_idct_mul_sse2(__m128i a, int k) {
+    __m128i kk = _mm_set1_epi16((short)k);
+    __m128i lo = _mm_mullo_epi16(a, kk);
+    __m128i hi = _mm_mulhi_epu16(a, kk);
+    return _mm_add_epi32(lo, _mm_slli_epi32(hi, 16));
+}
+
+#define PLM_SSE2_LOAD(P) _mm_loadu_si128((const __m128i *)(P))
+#define PLM_SSE2_STORE(P, V) _mm_storeu_si128((__m128i *)(P), V)
+#define PLM_SSE2_ROUND(V) _mm_srai_epi32(_mm_add_epi32(V, _mm_set1_epi32(128)), 8)
+#define PLM_SSE2_TRANSPOSE(R0, R1, R2, R3) do { \
+    __m128i t0 = _mm_unpacklo_epi32(R0, R1); \
+    __m128i t1 = _mm_unpacklo_epi32(R2, R3); \
+    __m128i t2 = _mm_unpackhi_epi32(R0, R1); \
+    __m128i t3 = _mm_unpackhi_epi32(R2, R3); \
+    R0 = _mm_unpacklo_epi64(t0, t1); \
+    R1 = _mm_unpackhi_epi64(t0, t1); \
+    R2 = _mm_unpacklo_epi64(t2, t3); \
+    R3 = _mm_unpackhi_epi64(t2, t3); \
+    } while(FALSE)
+
+PLM_DEFINE_VIDEO_IDCT4_FUNCTION(
+    plm_video_idct_sse2, __m128i, PLM_SSE2_LOAD, PLM_SSE2_STORE,
+    _mm_add_epi32, _mm_sub_epi32, plm_video_idct_mul_sse2, PLM_SSE2_ROUND,
+    _mm_setzero_si128(), PLM_SSE2_TRANSPOSE
+)
+
+#endif // PLM_SIMD_SSE2
+
+#ifdef PLM_SIMD_AVX2
+
+// A whole row fits in one register, so only the row pass needs a transpose.
+
+#define PLM_AVX2_MUL(V, K) _mm256_mullo_epi32(V, _mm256_set1_epi32(K))
+#define PLM_AVX2_ROUND(V) _mm256_srai_epi32(_mm256_add_epi32(V, _mm256_set1_epi32(128)), 8)
+
+#define PLM_AVX2_TRANSPOSE(e) do { \
+    __m256i t0 = _mm256_unpacklo_epi32(e[0], e[1]); \
+    __m256i t1 = _mm256_unpackhi_epi32(e[0], e[1]); \
+    __m256i t2 = _mm256_unpacklo_epi32(e[2], e[3]); \
+    __m256i t3 = _mm256_unpackhi_epi32(e[2], e[3]); \
+    __m256i t4 = _mm256_unpacklo_epi32(e[4], e[5]); \
+    __m256i t5 = _mm256_unpackhi_epi32(e[4], e[5]); \
+    __m256i t6 = _mm256_unpacklo_epi32(e[6], e[7]); \
+    __m256i t7 = _mm256_unpackhi_epi32(e[6], e[7]); \
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2); \
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2); \
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3); \
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3); \
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6); \
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6); \
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7); \
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7); \
+    e[0] = _mm256_permute2x128_si256(u0, u4, 0x20); \
+    e[1] = _mm256_permute2x128_si256(u1, u5, 0x20); \
+    e[2] = _mm256_permute2x128_si256(u2, u6, 0x20); \
+    e[3] = _mm256_permute2x128_si256(u3, u7, 0x20); \
+    e[4] = _mm256_permute2x128_si256(u0, u4, 0x31); \
+    e[5] = _mm256_permute2x128_si256(u1, u5, 0x31); \
+    e[6] = _mm256_permute2x128_si256(u2, u6, 0x31); \
+    e[7] = _mm256_permute2x128_si256(u3, u7, 0x31); \
+    } while(FALSE)
+
+PLM_TARGET_AVX2 void plm_video_idct_avx2(int *block) {
+    __m256i *b = (__m256i *)block;
+    __m256i e[8];
+    e[0] = _mm256_loadu_si256(b + 0); e[1] = _mm256_loadu_si256(b + 1);
+    e[2] = _mm256_loadu_si256(b + 2); e[3] = _mm256_loadu_si256(b + 3);
+    e[4] = _mm256_loadu_si256(b + 4); e[5] = _mm256_loadu_si256(b + 5);
+    e[6] = _mm256_loadu_si256(b + 6); e[7] = _mm256_loadu_si256(b + 7);
+
+    PLM_VIDEO_IDCT_BUTTERFLY(
+        __m256i, e, _mm256_add_epi32, _mm256_sub_epi32, PLM_AVX2_MUL,
+        PLM_AVX2_ROUND, _mm256_setzero_si256()
+    );
+    PLM_AVX2_TRANSPOSE(e);
+
+    PLM_VIDEO_IDCT_BUTTERFLY(
+        __m256i, e, _mm256_add_epi32, _mm256_sub_epi32, PLM_AVX2_MUL,
+        PLM_AVX2_ROUND, _mm256_setzero_si256()
+    );
+    e[0] = PLM_AVX2_ROUND(e[0]); e[1] = PLM_AVX2_ROUND(e[1]);
+    e[2] = PLM_AVX2_ROUND(e[2]); e[3] = PLM_AVX2_ROUND(e[3]);
+    e[4] = PLM_AVX2_ROUND(e[4]); e[5] = PLM_AVX2_ROUND(e[5]);
+    e[6] = PLM_AVX2_ROUND(e[6]); e[7] = PLM_AVX2_ROUND(e[7]);
+    PLM_AVX2_TRANSPOSE(e);
+
+    _mm256_storeu_si256(b + 0, e[0]); _mm256_storeu_si256(b + 1, e[1]);
+    _mm256_storeu_si256(b + 2, e[2]); _mm256_storeu_si256(b + 3, e[3]);
+    _mm256_storeu_si256(b + 4, e[4]); _mm256_storeu_si256(b + 5, e[5]);
+    _mm256_storeu_si256(b + 6, e[6]); _mm256_storeu_si256(b + 7, e[7]);
+}
+
+PLM_TARGET_AVX2 void plm_video_idct_avx2_4x4(int *block) {
+    __m256i *b = (__m256i *)block;
+    __m256i e[8];
+    e[0] = _mm256_loadu_si256(b + 0); e[1] = _mm256_loadu_si256(b + 1);
+    e[2] = _mm256_loadu_si256(b + 2); e[3] = _mm256_loadu_si256(b + 3);
+    e[4] = e[5] = e[6] = e[7] = _mm256_setzero_si256();
+
+    PLM_VIDEO_IDCT_BUTTERFLY(
+        __m256i, e, _mm256_add_epi32, _mm256_sub_epi32, PLM_AVX2_MUL,
+        PLM_AVX2_ROUND, _mm256_setzero_si256()
+    );
+    PLM_AVX2_TRANSPOSE(e);
+
+    // Columns 4-7 were zero going in, so they still are
+    e[4] = e[5] = e[6] = e[7] = _mm256_setzero_si256();
+    PLM_VIDEO_IDCT_BUTTERFLY(
+        __m256i, e, _mm256_add_epi32, _mm256_sub_epi32, PLM_AVX2_MUL,
+        PLM_AVX2_ROUND, _mm256_setzero_si256()
+    );
+    e[0] = PLM_AVX2_ROUND(e[0]); e[1] = PLM_AVX2_ROUND(e[1]);
+    e[2] = PLM_AVX2_ROUND(e[2]); e[3] = PLM_AVX2_ROUND(e[3]);
+    e[4] = PLM_AVX2_ROUND(e[4]); e[5] = PLM_AVX2_ROUND(e[5]);
+    e[6] = PLM_AVX2_ROUND(e[6]); e[7] = PLM_AVX2_ROUND(e[7]);
+    PLM_AVX2_TRANSPOSE(e);
+
+    _mm256_storeu_si256(b + 0, e[0]); _mm256_storeu_si256(b + 1, e[1]);
+    _mm256_storeu_si256(b + 2, e[2]); _mm256_storeu_si256(b + 3, e[3]);
+    _mm256_storeu_si256(b + 4, e[4]); _mm256_storeu_si256(b + 5, e[5]);
+    _mm256_storeu_si256(b + 6, e[6]); _mm256_storeu_si256(b + 7, e[7]);
+}
+
+#endif // PLM_SIMD_AVX2
+
+#ifdef PLM_SIMD_NEON
+
+// Note that vrshrq_n_s32() can't be used for rounding, as it doesn't wrap
+// around on overflow the way the scalar version does.
+
+#define PLM_NEON_ROUND(V) vshrq_n_s32(vaddq_s32(V, vdupq_n_s32(128)), 8)
+#define PLM_NEON_TRANSPOSE(R0, R1, R2, R3) do { \
+    int32x4x2_t t0 = vtrnq_s32(R0, R1); \
+    int32x4x2_t t1 = vtrnq_s32(R2, R3); \
+    R0 = vcombine_s32(vget_low_s32(t0.val[0]), vget_low_s32(t1.val[0])); \
+    R1 = vcombine_s32(vget_low_s32(t0.val[1]), vget_low_s32(t1.val[1])); \
+    R2 = vcombine_s32(vget_high_s32(t0.val[0]), vget_high_s32(t1.val[0])); \
+    R3 = vcombine_s32(vget_high_s32(t0.val[1]), vget_high_s32(t1.val[1])); \
+    } while(FALSE)
+
+PLM_DEFINE_VIDEO_IDCT4_FUNCTION(
+    plm_video_idct_neon, int32x4_t, vld1q_s32, vst1q_s32,
+    vaddq_s32, vsubq_s32, vmulq_n_s32, PLM_NEON_ROUND,
+    vdupq_n_s32(0), PLM_NEON_TRANSPOSE
+)
+
+#endif // PLM_SIMD_NEON
+
+void plm_video_select_idct(plm_video_t *self) {
+    #ifdef PLM_SIMD_AVX2
+        if (plm_cpu_has_avx2()) {
+            self->idct = plm_video_idct_avx2;
+            self->idct_4x4 = plm_video_idct_avx2_4x4;
+            return;
+        }
+    #endif
+
+    #if defined(PLM_SIMD_SSE2)
+        self->idct = plm_video_idct_sse2;
+        self->idct_4x4 = plm_video_idct_sse2_4x4;
+    #elif defined(PLM_SIMD_NEON)
+        self->idct = plm_video_idct_neon;
+        self->idct_4x4 = plm_video_idct_neon_4x4;
+    #else
+        self->idct = plm_video_idct;
+        self->idct_4x4 = plm_video_idct_4x4;
+    #endif
+}
+
 // YCbCr conversion following the BT.601 standard:
 // https://infogalactic.com/info/YCbCr#ITU-R_BT.601_conversion
+// The coefficients are 16.16 fixed point. The limited range ones are those
+// plm_frame_to_rgb() and friends have always used, and every code path below
+// reproduces their results exactly.
 
-#define PLM_PUT_PIXEL(RI, GI, BI, Y_OFFSET, DEST_OFFSET) \
-    y = ((frame->y.data[y_index + Y_OFFSET]-16) * 76309) >> 16; \
-    dest[d_index + DEST_OFFSET + RI] = plm_clamp(y + r); \
-    dest[d_index + DEST_OFFSET + GI] = plm_clamp(y - g); \
-    dest[d_index + DEST_OFFSET + BI] = plm_clamp(y + b);
+typedef struct {
+    int y_offset;
+    int y;
+    int cr_r;
+    int cb_g;
+    int cr_g;
+    int cb_b;
+} plm_color_coefficients_t;
+
+static const plm_color_coefficients_t PLM_COLOR_COEFFICIENTS[] = {
+    {16, 76309, 104597, 25674, 53278, 132201}, // PLM_COLOR_RANGE_LIMITED
+    { 0, 65536,  91881, 22554, 46802, 116130}  // PLM_COLOR_RANGE_FULL
+};
 
-#define PLM_DEFINE_FRAME_CONVERT_FUNCTION(NAME, BYTES_PER_PIXEL, RI, GI, BI) \
-    void NAME(plm_frame_t *frame, uint8_t *dest, int stride) { \
-        int cols = frame->width >> 1; \
-        int rows = frame->height >> 1; \
-        int yw = frame->y.width; \
-        int cw = frame->cb.width; \
-        for (int row = 0; row < rows; row++) { \
-            int c_index = row * cw; \
-            int y_index = row * 2 * yw; \
-            int d_index = row * 2 * stride; \
-            for (int col = 0; col < cols; col++) { \
-                int y; \
-                int cr = frame->cr.data[c_index] - 128; \
-                int cb = frame->cb.data[c_index] - 128; \
-                int r = (cr * 104597) >> 16; \
-                int g = (cb * 25674 + cr * 53278) >> 16; \
-                int b = (cb * 132201) >> 16; \
-                PLM_PUT_PIXEL(RI, GI, BI, 0,      0); \
-                PLM_PUT_PIXEL(RI, GI, BI, 1,      BYTES_PER_PIXEL); \
-                PLM_PUT_PIXEL(RI, GI, BI, yw,     stride); \
-                PLM_PUT_PIXEL(RI, GI, BI, yw + 1, stride + BYTES_PER_PIXEL); \
-                c_index += 1; \
-                y_index += 2; \
-                d_index += 2 * BYTES_PER_PIXEL; \
+// Bytes per pixel and the offsets of R, G and B for each PLM_PIXEL_FORMAT_*
+static const int PLM_PIXEL_LAYOUTS[][4] = {
+    {3, 0, 1, 2}, // RGB
+    {3, 2, 1, 0}, // BGR
+    {4, 0, 1, 2}, // RGBA
+    {4, 2, 1, 0}, // BGRA
+    {4, 1, 2, 3}, // ARGB
+    {4, 3, 2, 1}  // ABGR
+};
+
+typedef struct {
+    const uint8_t *y;
+    const uint8_t *cb;
+    const uint8_t *cr;
+    int y_stride;
+    int c_stride;
+    uint8_t *dest;
+    int stride;
+    int width;
+    int height;
+    int format;
+    int bytes_per_pixel;
+    int ri;
+    int gi;
+    int bi;
+    const plm_color_coefficients_t *k;
+} plm_pixels_job_t;
+
+// Convert the row at row and the one below it, if there is one, from column x
+// to the end of the rows. x must be even. There's a version of this for each
+// pixel format, so that the byte offsets are constant.
+
+#define PLM_PUT_PIXEL(RI, GI, BI, Y, DEST) \
+    y = (((Y) - y_offset) * ky) >> 16; \
+    (DEST)[RI] = plm_clamp(y + r); \
+    (DEST)[GI] = plm_clamp(y - g); \
+    (DEST)[BI] = plm_clamp(y + b);
+
+#define PLM_DEFINE_PIXELS_CONVERT_FUNCTION(NAME, BYTES_PER_PIXEL, RI, GI, BI) \
+    void NAME(const plm_pixels_job_t *job, int row, int x) { \
+        int y_offset = job->k->y_offset; \
+        int ky = job->k->y; \
+        int k_cr_r = job->k->cr_r; \
+        int k_cb_g = job->k->cb_g; \
+        int k_cr_g = job->k->cr_g; \
+        int k_cb_b = job->k->cb_b; \
+        int width = job->width; \
+        int has_pair = row + 1 < job->height; \
+        const uint8_t *y0 = job->y + row * job->y_stride; \
+        const uint8_t *y1 = y0 + job->y_stride; \
+        const uint8_t *cb = job->cb + (row >> 1) * job->c_stride; \
+        const uint8_t *cr = job->cr + (row >> 1) * job->c_stride; \
+        uint8_t *d0 = job->dest + row * job->stride; \
+        uint8_t *d1 = d0 + job->stride; \
+        for (; x < width; x += 2) { \
+            int y; \
+            int vcb = cb[x >> 1] - 128; \
+            int vcr = cr[x >> 1] - 128; \
+            int r = (vcr * k_cr_r) >> 16; \
+            int g = (vcb * k_cb_g + vcr * k_cr_g) >> 16; \
+            int b = (vcb * k_cb_b) >> 16; \
+            if (x + 1 < width && has_pair) { \
+                PLM_PUT_PIXEL(RI, GI, BI, y0[x],     d0 + x * BYTES_PER_PIXEL); \
+                PLM_PUT_PIXEL(RI, GI, BI, y0[x + 1], d0 + x * BYTES_PER_PIXEL + BYTES_PER_PIXEL); \
+                PLM_PUT_PIXEL(RI, GI, BI, y1[x],     d1 + x * BYTES_PER_PIXEL); \
+                PLM_PUT_PIXEL(RI, GI, BI, y1[x + 1], d1 + x * BYTES_PER_PIXEL + BYTES_PER_PIXEL); \
+                continue; \
+            } \
+            /* The last column or row of an odd sized image */ \
+            PLM_PUT_PIXEL(RI, GI, BI, y0[x], d0 + x * BYTES_PER_PIXEL); \
+            if (x + 1 < width) { \
+                PLM_PUT_PIXEL(RI, GI, BI, y0[x + 1], d0 + x * BYTES_PER_PIXEL + BYTES_PER_PIXEL); \
+            } \
+            if (has_pair) { \
+                PLM_PUT_PIXEL(RI, GI, BI, y1[x], d1 + x * BYTES_PER_PIXEL); \
             } \
         } \
     }
 
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgb,  3, 0, 1, 2)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgr,  3, 2, 1, 0)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgba, 4, 0, 1, 2)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgra, 4, 2, 1, 0)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_argb, 4, 1, 2, 3)
-PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_abgr, 4, 3, 2, 1)
-
+PLM_DEFINE_PIXELS_CONVERT_FUNCTION(plm_pixels_convert_rgb,  3, 0, 1, 2)
+PLM_DEFINE_PIXELS_CONVERT_FUNCTION(plm_pixels_convert_bgr,  3, 2, 1, 0)
+PLM_DEFINE_PIXELS_CONVERT_FUNCTION(plm_pixels_convert_rgba, 4, 0, 1, 2)
+PLM_DEFINE_PIXELS_CONVERT_FUNCTION(plm_pixels_convert_bgra, 4, 2, 1, 0)
+PLM_DEFINE_PIXELS_CONVERT_FUNCTION(plm_pixels_convert_argb, 4, 1, 2, 3)
+PLM_DEFINE_PIXELS_CONVERT_FUNCTION(plm_pixels_convert_abgr, 4, 3, 2, 1)
 
 #undef PLM_PUT_PIXEL
+#undef PLM_DEFINE_PIXELS_CONVERT_FUNCTION
+
+// Indexed by PLM_PIXEL_FORMAT_*
+static void (*const PLM_PIXELS_CONVERT_SCALAR[])(const plm_pixels_job_t *job, int row, int x) = {
+    plm_pixels_convert_rgb,
+    plm_pixels_convert_bgr,
+    plm_pixels_convert_rgba,
+    plm_pixels_convert_bgra,
+    plm_pixels_convert_argb,
+    plm_pixels_convert_abgr
+};
+
+// The SIMD versions convert as many whole blocks of a pair of rows as they can,
+// and return the column at which the scalar version should take over.
+
+// To stay exact with 16bit lanes, (a * k) >> 16 is split into a multiple of
+// 65536 and a remainder which fits in 16 bits: a * hi + ((a * lo) >> 16).
+
+#define PLM_FIXED_HI(K) (((K) + 32768) >> 16)
+#define PLM_FIXED_LO(K) ((K) - PLM_FIXED_HI(K) * 65536)
+
+#ifdef PLM_SIMD_SSE2
+
+static inline __m128i plm_pixels_mul_sse2(__m128i a, int k) {
+    return _mm_add_epi16(
+        _mm_mullo_epi16(a, _mm_set1_epi16((short)PLM_FIXED_HI(k))),
+        _mm_mulhi_epi16(a, _mm_set1_epi16((short)PLM_FIXED_LO(k)))
+    );
+}
+
+// Interleave 16 pixels of 4 channels, keeping the bytes of dest where the
+// mask is set
+static inline void plm_pixels_store4_sse2(
+    uint8_t *dest, __m128i c0, __m128i c1, __m128i c2, __m128i c3, __m128i mask
+) {
+    __m128i t0 = _mm_unpacklo_epi8(c0, c1);
+    __m128i t1 = _mm_unpackhi_epi8(c0, c1);
+    __m128i t2 = _mm_unpacklo_epi8(c2, c3);
+    __m128i t3 = _mm_unpackhi_epi8(c2, c3);
+    __m128i p[4];
+    p[0] = _mm_unpacklo_epi16(t0, t2);
+    p[1] = _mm_unpackhi_epi16(t0, t2);
+    p[2] = _mm_unpacklo_epi16(t1, t3);
+    p[3] = _mm_unpackhi_epi16(t1, t3);
+    for (int i = 0; i < 4; i++) {
+        __m128i *d = (__m128i *)(dest + i * 16);
+        __m128i kept = _mm_and_si128(_mm_loadu_si128(d), mask);
+        _mm_storeu_si128(d, _mm_or_si128(kept, p[i]));
+    }
+}
+
+// Store 16 converted pixels in the job's format. Alpha bytes are left as they
+// are, and there's no 3 byte shuffle in SSE2 so those are written one by one.
+static inline void plm_pixels_store_sse2(
+    const plm_pixels_job_t *job, uint8_t *dest, __m128i r, __m128i g, __m128i b
+) {
+    __m128i z = _mm_setzero_si128();
+    if (job->format == PLM_PIXEL_FORMAT_RGBA) {
+        plm_pixels_store4_sse2(dest, r, g, b, z, _mm_set1_epi32((int)0xff000000));
+    }
+    else if (job->format == PLM_PIXEL_FORMAT_BGRA) {
+        plm_pixels_store4_sse2(dest, b, g, r, z, _mm_set1_epi32((int)0xff000000));
+    }
+    else if (job->format == PLM_PIXEL_FORMAT_ARGB) {
+        plm_pixels_store4_sse2(dest, z, r, g, b, _mm_set1_epi32(0x000000ff));
+    }
+    else if (job->format == PLM_PIXEL_FORMAT_ABGR) {
+        plm_pixels_store4_sse2(dest, z, b, g, r, _mm_set1_epi32(0x000000ff));
+    }
+    else {
+        uint8_t c[3][16];
+        _mm_storeu_si128((__m128i *)c[0], r);
+        _mm_storeu_si128((__m128i *)c[1], g);
+        _mm_storeu_si128((__m128i *)c[2], b);
+        for (int i = 0; i < 16; i++) {
+            dest[job->ri] = c[0][i];
+            dest[job->gi] = c[1][i];
+            dest[job->bi] = c[2][i];
+            dest += 3;
+        }
+    }
+}
+
+int plm_pixels_convert_sse2(const plm_pixels_job_t *job, int row) {
+    const plm_color_coefficients_t *k = job->k;
+    const uint8_t *cb = job->cb + (row >> 1) * job->c_stride;
+    const uint8_t *cr = job->cr + (row >> 1) * job->c_stride;
+    __m128i zero = _mm_setzero_si128();
+    __m128i bias = _mm_set1_epi16(128);
+    __m128i y_offset = _mm_set1_epi16((short)k->y_offset);
+    __m128i g_lo = _mm_set_epi16(
+        (short)PLM_FIXED_LO(k->cr_g), (short)PLM_FIXED_LO(k->cb_g),
+        (short)PLM_FIXED_LO(k->cr_g), (short)PLM_FIXED_LO(k->cb_g),
+        (short)PLM_FIXED_LO(k->cr_g), (short)PLM_FIXED_LO(k->cb_g),
+        (short)PLM_FIXED_LO(k->cr_g), (short)PLM_FIXED_LO(k->cb_g)
+    );
+    __m128i g_cb_hi = _mm_set1_epi16((short)PLM_FIXED_HI(k->cb_g));
+    __m128i g_cr_hi = _mm_set1_epi16((short)PLM_FIXED_HI(k->cr_g));
+
+    int x = 0;
+    for (; x + 16 <= job->width; x += 16) {
+        __m128i vcb = _mm_loadl_epi64((const __m128i *)(cb + (x >> 1)));
+        __m128i vcr = _mm_loadl_epi64((const __m128i *)(cr + (x >> 1)));
+        vcb = _mm_sub_epi16(_mm_unpacklo_epi8(vcb, zero), bias);
+        vcr = _mm_sub_epi16(_mm_unpacklo_epi8(vcr, zero), bias);
+
+        __m128i r = plm_pixels_mul_sse2(vcr, k->cr_r);
+        __m128i b = plm_pixels_mul_sse2(vcb, k->cb_b);
+
+        // The two products of g are summed before shifting, so their low
+        // parts go through a 32bit multiply-add
+        __m128i g0 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(vcb, vcr), g_lo), 16);
+        __m128i g1 = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(vcb, vcr), g_lo), 16);
+        __m128i g = _mm_add_epi16(
+            _mm_packs_epi32(g0, g1),
+            _mm_add_epi16(_mm_mullo_epi16(vcb, g_cb_hi), _mm_mullo_epi16(vcr, g_cr_hi))
+        );
+
+        // Each chroma sample covers two pixels
+        __m128i rr[2] = {_mm_unpacklo_epi16(r, r), _mm_unpackhi_epi16(r, r)};
+        __m128i gg[2] = {_mm_unpacklo_epi16(g, g), _mm_unpackhi_epi16(g, g)};
+        __m128i bb[2] = {_mm_unpacklo_epi16(b, b), _mm_unpackhi_epi16(b, b)};
+
+        for (int i = 0; i < 2; i++) {
+            __m128i vy = _mm_loadu_si128((const __m128i *)(job->y + (row + i) * job->y_stride + x));
+            __m128i y0 = plm_pixels_mul_sse2(_mm_sub_epi16(_mm_unpacklo_epi8(vy, zero), y_offset), k->y);
+            __m128i y1 = plm_pixels_mul_sse2(_mm_sub_epi16(_mm_unpackhi_epi8(vy, zero), y_offset), k->y);
+
+            plm_pixels_store_sse2(
+                job, job->dest + (row + i) * job->stride + x * job->bytes_per_pixel,
+                _mm_packus_epi16(_mm_add_epi16(y0, rr[0]), _mm_add_epi16(y1, rr[1])),
+                _mm_packus_epi16(_mm_sub_epi16(y0, gg[0]), _mm_sub_epi16(y1, gg[1])),
+                _mm_packus_epi16(_mm_add_epi16(y0, bb[0]), _mm_add_epi16(y1, bb[1]))
+            );
+        }
+    }
+    return x;
+}
+
+#endif // PLM_SIMD_SSE2
+
+#ifdef PLM_SIMD_AVX2
+
+// As the SSE2 version, but 32 pixels at a time. The unpacks and packs work
+// within 128bit lanes, so the results are permuted back into order and then
+// stored as two halves.
+
+PLM_TARGET_AVX2 static inline __m256i plm_pixels_mul_avx2(__m256i a, int k) {
+    return _mm256_add_epi16(
+        _mm256_mullo_epi16(a, _mm256_set1_epi16((short)PLM_FIXED_HI(k))),
+        _mm256_mulhi_epi16(a, _mm256_set1_epi16((short)PLM_FIXED_LO(k)))
+    );
+}
+
+// CPUs with AVX2 also have SSSE3, so 3 byte pixels can be interleaved with
+// byte shuffles. Each row selects the bytes of one channel for one of the
+// three 16 byte blocks of output.
+
+#define PLM_Z -128
+static const int8_t PLM_PIXELS_SHUFFLE_3[3][3][16] = {
+    {
+        {0, PLM_Z, PLM_Z, 1, PLM_Z, PLM_Z, 2, PLM_Z, PLM_Z, 3, PLM_Z, PLM_Z, 4, PLM_Z, PLM_Z, 5},
+        {PLM_Z, 0, PLM_Z, PLM_Z, 1, PLM_Z, PLM_Z, 2, PLM_Z, PLM_Z, 3, PLM_Z, PLM_Z, 4, PLM_Z, PLM_Z},
+        {PLM_Z, PLM_Z, 0, PLM_Z, PLM_Z, 1, PLM_Z, PLM_Z, 2, PLM_Z, PLM_Z, 3, PLM_Z, PLM_Z, 4, PLM_Z}
+    },
+    {
+        {PLM_Z, PLM_Z, 6, PLM_Z, PLM_Z, 7, PLM_Z, PLM_Z, 8, PLM_Z, PLM_Z, 9, PLM_Z, PLM_Z, 10, PLM_Z},
+        {5, PLM_Z, PLM_Z, 6, PLM_Z, PLM_Z, 7, PLM_Z, PLM_Z, 8, PLM_Z, PLM_Z, 9, PLM_Z, PLM_Z, 10},
+        {PLM_Z, 5, PLM_Z, PLM_Z, 6, PLM_Z, PLM_Z, 7, PLM_Z, PLM_Z, 8, PLM_Z, PLM_Z, 9, PLM_Z, PLM_Z}
+    },
+    {
+        {PLM_Z, 11, PLM_Z, PLM_Z, 12, PLM_Z, PLM_Z, 13, PLM_Z, PLM_Z, 14, PLM_Z, PLM_Z, 15, PLM_Z, PLM_Z},
+        {PLM_Z, PLM_Z, 11, PLM_Z, PLM_Z, 12, PLM_Z, PLM_Z, 13, PLM_Z, PLM_Z, 14, PLM_Z, PLM_Z, 15, PLM_Z},
+        {10, PLM_Z, PLM_Z, 11, PLM_Z, PLM_Z, 12, PLM_Z, PLM_Z, 13, PLM_Z, PLM_Z, 14, PLM_Z, PLM_Z, 15}
+    }
+};
+#undef PLM_Z
+
+PLM_TARGET_AVX2 static inline void plm_pixels_store_avx2(
+    const plm_pixels_job_t *job, uint8_t *dest, __m128i r, __m128i g, __m128i b
+) {
+    if (job->bytes_per_pixel == 4) {
+        plm_pixels_store_sse2(job, dest, r, g, b);
+        return;
+    }
+
+    __m128i c[3];
+    c[job->ri] = r;
+    c[job->gi] = g;
+    c[job->bi] = b;
+    for (int i = 0; i < 3; i++) {
+        __m128i p = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(c[0], _mm_loadu_si128((const __m128i *)PLM_PIXELS_SHUFFLE_3[i][0])),
+                _mm_shuffle_epi8(c[1], _mm_loadu_si128((const __m128i *)PLM_PIXELS_SHUFFLE_3[i][1]))
+            ),
+            _mm_shuffle_epi8(c[2], _mm_loadu_si128((const __m128i *)PLM_PIXELS_SHUFFLE_3[i][2]))
+        );
+        _mm_storeu_si128((__m128i *)(dest + i * 16), p);
+    }
+}
+
+PLM_TARGET_AVX2 int plm_pixels_convert_avx2(const plm_pixels_job_t *job, int row) {
+    const plm_color_coefficients_t *k = job->k;
+    const uint8_t *cb = job->cb + (row >> 1) * job->c_stride;
+    const uint8_t *cr = job->cr + (row >> 1) * job->c_stride;
+    __m256i bias = _mm256_set1_epi16(128);
+    __m256i y_offset = _mm256_set1_epi16((short)k->y_offset);
+    __m256i g_lo = _mm256_set1_epi32(
+        (int)(((uint32_t)(uint16_t)PLM_FIXED_LO(k->cr_g) << 16) | (uint16_t)PLM_FIXED_LO(k->cb_g))
+    );
+    __m256i g_cb_hi = _mm256_set1_epi16((short)PLM_FIXED_HI(k->cb_g));
+    __m256i g_cr_hi = _mm256_set1_epi16((short)PLM_FIXED_HI(k->cr_g));
+
+    int x = 0;
+    for (; x + 32 <= job->width; x += 32) {
+        __m256i vcb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cb + (x >> 1))));
+        __m256i vcr = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(cr + (x >> 1))));
+        vcb = _mm256_sub_epi16(vcb, bias);
+        vcr = _mm256_sub_epi16(vcr, bias);
+
+        __m256i r = plm_pixels_mul_avx2(vcr, k->cr_r);
+        __m256i b = plm_pixels_mul_avx2(vcb, k->cb_b);
+        __m256i g0 = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(vcb, vcr), g_lo), 16);
+        __m256i g1 = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(vcb, vcr), g_lo), 16);
+        __m256i g = _mm256_add_epi16(
+            _mm256_packs_epi32(g0, g1),
+            _mm256_add_epi16(_mm256_mullo_epi16(vcb, g_cb_hi), _mm256_mullo_epi16(vcr, g_cr_hi))
+        );
+
+        __m256i c[3] = {r, g, b};
+        __m256i cc[3][2];
+        for (int j = 0; j < 3; j++) {
+            __m256i lo = _mm256_unpacklo_epi16(c[j], c[j]);
+            __m256i hi = _mm256_unpackhi_epi16(c[j], c[j]);
+            cc[j][0] = _mm256_permute2x128_si256(lo, hi, 0x20);
+            cc[j][1] = _mm256_permute2x128_si256(lo, hi, 0x31);
+        }
+
+        for (int i = 0; i < 2; i++) {
+            __m256i vy = _mm256_loadu_si256((const __m256i *)(job->y + (row + i) * job->y_stride + x));
+            __m256i y0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(vy));
+            __m256i y1 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(vy, 1));
+            y0 = plm_pixels_mul_avx2(_mm256_sub_epi16(y0, y_offset), k->y);
+            y1 = plm_pixels_mul_avx2(_mm256_sub_epi16(y1, y_offset), k->y);
+
+            __m256i vr = _mm256_packus_epi16(_mm256_add_epi16(y0, cc[0][0]), _mm256_add_epi16(y1, cc[0][1]));
+            __m256i vg = _mm256_packus_epi16(_mm256_sub_epi16(y0, cc[1][0]), _mm256_sub_epi16(y1, cc[1][1]));
+            __m256i vb = _mm256_packus_epi16(_mm256_add_epi16(y0, cc[2][0]), _mm256_add_epi16(y1, cc[2][1]));
+            vr = _mm256_permute4x64_epi64(vr, 0xD8);
+            vg = _mm256_permute4x64_epi64(vg, 0xD8);
+            vb = _mm256_permute4x64_epi64(vb, 0xD8);
+
+            uint8_t *d = job->dest + (row + i) * job->stride + x * job->bytes_per_pixel;
+            plm_pixels_store_avx2(
+                job, d,
+                _mm256_castsi256_si128(vr), _mm256_castsi256_si128(vg), _mm256_castsi256_si128(vb)
+            );
+            plm_pixels_store_avx2(
+                job, d + 16 * job->bytes_per_pixel,
+                _mm256_extracti128_si256(vr, 1), _mm256_extracti128_si256(vg, 1), _mm256_extracti128_si256(vb, 1)
+            );
+        }
+    }
+    return x;
+}
+
+#endif // PLM_SIMD_AVX2
+
+#ifdef PLM_SIMD_NEON
+
+// NEON can widen to 32bit and multiply by the full coefficients, and has
+// interleaving loads and stores for 3 and 4 channels.
+
+static inline int16x8_t plm_pixels_mul_neon(int16x8_t a, int k) {
+    int32x4_t lo = vmulq_n_s32(vmovl_s16(vget_low_s16(a)), k);
+    int32x4_t hi = vmulq_n_s32(vmovl_s16(vget_high_s16(a)), k);
+    return vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16));
+}
+
+static inline int16x8_t plm_pixels_mul_add_neon(int16x8_t a, int ka, int16x8_t b, int kb) {
+    int32x4_t lo = vmulq_n_s32(vmovl_s16(vget_low_s16(a)), ka);
+    int32x4_t hi = vmulq_n_s32(vmovl_s16(vget_high_s16(a)), ka);
+    lo = vmlaq_n_s32(lo, vmovl_s16(vget_low_s16(b)), kb);
+    hi = vmlaq_n_s32(hi, vmovl_s16(vget_high_s16(b)), kb);
+    return vcombine_s16(vshrn_n_s32(lo, 16), vshrn_n_s32(hi, 16));
+}
+
+static inline int16x8_t plm_pixels_widen_neon(uint8x8_t v, int16x8_t offset) {
+    return vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v)), offset);
+}
+
+int plm_pixels_convert_neon(const plm_pixels_job_t *job, int row) {
+    const plm_color_coefficients_t *k = job->k;
+    const uint8_t *cb = job->cb + (row >> 1) * job->c_stride;
+    const uint8_t *cr = job->cr + (row >> 1) * job->c_stride;
+    int16x8_t bias = vdupq_n_s16(128);
+    int16x8_t y_offset = vdupq_n_s16((int16_t)k->y_offset);
+
+    int x = 0;
+    for (; x + 16 <= job->width; x += 16) {
+        int16x8_t vcb = plm_pixels_widen_neon(vld1_u8(cb + (x >> 1)), bias);
+        int16x8_t vcr = plm_pixels_widen_neon(vld1_u8(cr + (x >> 1)), bias);
+
+        int16x8x2_t r = vzipq_s16(plm_pixels_mul_neon(vcr, k->cr_r), plm_pixels_mul_neon(vcr, k->cr_r));
+        int16x8x2_t g = vzipq_s16(
+            plm_pixels_mul_add_neon(vcb, k->cb_g, vcr, k->cr_g),
+            plm_pixels_mul_add_neon(vcb, k->cb_g, vcr, k->cr_g)
+        );
+        int16x8x2_t b = vzipq_s16(plm_pixels_mul_neon(vcb, k->cb_b), plm_pixels_mul_neon(vcb, k->cb_b));
+
+        for (int i = 0; i < 2; i++) {
+            uint8x16_t vy = vld1q_u8(job->y + (row + i) * job->y_stride + x);
+            int16x8_t y0 = plm_pixels_mul_neon(plm_pixels_widen_neon(vget_low_u8(vy), y_offset), k->y);
+            int16x8_t y1 = plm_pixels_mul_neon(plm_pixels_widen_neon(vget_high_u8(vy), y_offset), k->y);
+
+            uint8x16_t vr = vcombine_u8(vqmovun_s16(vaddq_s16(y0, r.val[0])), vqmovun_s16(vaddq_s16(y1, r.val[1])));
+            uint8x16_t vg = vcombine_u8(vqmovun_s16(vsubq_s16(y0, g.val[0])), vqmovun_s16(vsubq_s16(y1, g.val[1])));
+            uint8x16_t vb = vcombine_u8(vqmovun_s16(vaddq_s16(y0, b.val[0])), vqmovun_s16(vaddq_s16(y1, b.val[1])));
+
+            uint8_t *d = job->dest + (row + i) * job->stride + x * job->bytes_per_pixel;
+            if (job->bytes_per_pixel == 4) {
+                // Load the destination so that alpha is left as it was
+                uint8x16x4_t p = vld4q_u8(d);
+                p.val[job->ri] = vr;
+                p.val[job->gi] = vg;
+                p.val[job->bi] = vb;
+                vst4q_u8(d, p);
+            }
+            else {
+                uint8x16x3_t p;
+                p.val[job->ri] = vr;
+                p.val[job->gi] = vg;
+                p.val[job->bi] = vb;
+                vst3q_u8(d, p);
+            }
+        }
+    }
+    return x;
+}
+
+#endif // PLM_SIMD_NEON
+
+#undef PLM_FIXED_HI
+#undef PLM_FIXED_LO
+
+void plm_planes_to_pixels(
+    const uint8_t *y, int y_stride, const uint8_t *cb, const uint8_t *cr, int c_stride,
+    int width, int height, uint8_t *dest, int stride, int format, int range
+) {
+    if (
+        format < PLM_PIXEL_FORMAT_RGB || format > PLM_PIXEL_FORMAT_ABGR ||
+        range < PLM_COLOR_RANGE_LIMITED || range > PLM_COLOR_RANGE_FULL
+    ) {
+        return;
+    }
+
+    plm_pixels_job_t job;
+    job.y = y;
+    job.cb = cb;
+    job.cr = cr;
+    job.y_stride = y_stride;
+    job.c_stride = c_stride;
+    job.dest = dest;
+    job.stride = stride;
+    job.width = width;
+    job.height = height;
+    job.format = format;
+    job.bytes_per_pixel = PLM_PIXEL_LAYOUTS[format][0];
+    job.ri = PLM_PIXEL_LAYOUTS[format][1];
+    job.gi = PLM_PIXEL_LAYOUTS[format][2];
+    job.bi = PLM_PIXEL_LAYOUTS[format][3];
+    job.k = &PLM_COLOR_COEFFICIENTS[range];
+
+    int (*convert)(const plm_pixels_job_t *job, int row) = NULL;
+    #if defined(PLM_SIMD_SSE2)
+        convert = plm_pixels_convert_sse2;
+    #elif defined(PLM_SIMD_NEON)
+        convert = plm_pixels_convert_neon;
+    #endif
+    #ifdef PLM_SIMD_AVX2
+        if (plm_cpu_has_avx2()) {
+            convert = plm_pixels_convert_avx2;
+        }
+    #endif
+
+    for (int row = 0; row < height; row += 2) {
+        // The SIMD versions only handle whole pairs of rows
+        int x = (convert && row + 1 < height) ? convert(&job, row) : 0;
+        PLM_PIXELS_CONVERT_SCALAR[format](&job, row, x);
+    }
+}
+
+void plm_frame_to_pixels(plm_frame_t *frame, uint8_t *dest, int stride, int format, int range) {
+    plm_planes_to_pixels(
+        frame->y.data, frame->y.width, frame->cb.data, frame->cr.data, frame->cb.width,
+        frame->width, frame->height, dest, stride, format, range
+    );
+}
+
+// These have always skipped the last column and row of odd sized frames
+
+#define PLM_DEFINE_FRAME_CONVERT_FUNCTION(NAME, FORMAT) \
+    void NAME(plm_frame_t *frame, uint8_t *dest, int stride) { \
+        plm_planes_to_pixels( \
+            frame->y.data, frame->y.width, frame->cb.data, frame->cr.data, frame->cb.width, \
+            frame->width & ~1, frame->height & ~1, dest, stride, FORMAT, PLM_COLOR_RANGE_LIMITED \
+        ); \
+    }
+
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgb,  PLM_PIXEL_FORMAT_RGB)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgr,  PLM_PIXEL_FORMAT_BGR)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_rgba, PLM_PIXEL_FORMAT_RGBA)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_bgra, PLM_PIXEL_FORMAT_BGRA)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_argb, PLM_PIXEL_FORMAT_ARGB)
+PLM_DEFINE_FRAME_CONVERT_FUNCTION(plm_frame_to_abgr, PLM_PIXEL_FORMAT_ABGR)
+
 #undef PLM_DEFINE_FRAME_CONVERT_FUNCTION
 
 
@@ -3712,6 +5543,9 @@ typedef struct plm_audio_t {
     float D[1024];
     float V[2][1024];
     float U[32];
+
+    void (*idct36)(int s[32][3], int ss, float *d, int dp);
+    void (*window)(const float *d, const float *v, int v_pos, float *u);
 } plm_audio_t;
 
 int plm_audio_find_frame_sync(plm_audio_t *self);
@@ -3720,6 +5554,8 @@ void plm_audio_decode_frame(plm_audio_t *self);
 const plm_quantizer_spec_t *plm_audio_read_allocation(plm_audio_t *self, int sb, int tab3);
 void plm_audio_read_samples(plm_audio_t *self, int ch, int sb, int part); 
 void plm_audio_idct36(int s[32][3], int ss, float *d, int dp);
+void plm_audio_window(const float *d, const float *v, int v_pos, float *u);
+void plm_audio_select_synthesis(plm_audio_t *self);
 
 plm_audio_t *plm_audio_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
     plm_audio_t *self = (plm_audio_t *)malloc(sizeof(plm_audio_t));
@@ -3732,6 +5568,7 @@ plm_audio_t *plm_audio_create_with_buffer(plm_buffer_t *buffer, int destroy_when
 
     memcpy(self->D, PLM_AUDIO_SYNTHESIS_WINDOW, 512 * sizeof(float));
     memcpy(self->D + 512, PLM_AUDIO_SYNTHESIS_WINDOW, 512 * sizeof(float));
+    plm_audio_select_synthesis(self);
 
     // Attempt to decode first header
     self->next_frame_data_size = plm_audio_decode_header(self);
@@ -4017,32 +5854,10 @@ void plm_audio_decode_frame(plm_audio_t *self) {
                 self->v_pos = (self->v_pos - 64) & 1023;
 
                 for (int ch = 0; ch < 2; ch++) {
-                    plm_audio_idct36(self->sample[ch], p, self->V[ch], self->v_pos);
+                    self->idct36(self->sample[ch], p, self->V[ch], self->v_pos);
 
                     // Build U, windowing, calculate output
-                    memset(self->U, 0, sizeof(self->U));
-
-                    int d_index = 512 - (self->v_pos >> 1);
-                    int v_index = (self->v_pos % 128) >> 1;
-                    while (v_index < 1024) {
-                        for (int i = 0; i < 32; ++i) {
-                            self->U[i] += self->D[d_index++] * self->V[ch][v_index++];
-                        }
-
-                        v_index += 128 - 32;
-                        d_index += 64 - 32;
-                    }
-
-                    d_index -= (512 - 32);
-                    v_index = (128 - 32 + 1024) - v_index;
-                    while (v_index < 1024) {
-                        for (int i = 0; i < 32; ++i) {
-                            self->U[i] += self->D[d_index++] * self->V[ch][v_index++];
-                        }
-
-                        v_index += 128 - 32;
-                        d_index += 64 - 32;
-                    }
+                    self->window(self->D, self->V[ch], self->v_pos, self->U);
 
                     // Output samples
                     #ifdef PLM_AUDIO_SEPARATE_CHANNELS
@@ -4266,5 +6081,808 @@ void plm_audio_idct36(int s[32][3], int ss, float *d, int dp) {
     d[dp + 15] = t02; d[dp + 16] = 0.0;
 }
 
+void plm_audio_window(const float *d, const float *v, int v_pos, float *u) {
+    memset(u, 0, 32 * sizeof(float));
+
+    int d_index = 512 - (v_pos >> 1);
+    int v_index = (v_pos % 128) >> 1;
+    while (v_index < 1024) {
+        for (int i = 0; i < 32; ++i) {
+            u[i] += d[d_index++] * v[v_index++];
+        }
+
+        v_index += 128 - 32;
+        d_index += 64 - 32;
+    }
+
+    d_index -= (512 - 32);
+    v_index = (128 - 32 + 1024) - v_index;
+    while (v_index < 1024) {
+        for (int i = 0; i < 32; ++i) {
+            u[i] += d[d_index++] * v[v_index++];
+        }
+
+        v_index += 128 - 32;
+        d_index += 64 - 32;
+    }
+}
+
+// The SIMD versions of the windowing keep all 32 sums in registers. Each sum
+// is still built up one product at a time in the same order, with separate
+// multiplies and adds rather than fused ones, so they match the scalar version
+// exactly.
+
+#define PLM_DEFINE_AUDIO_WINDOW_FUNCTION(NAME, TYPE, LANES, ZERO, LOAD, STORE, ADD, MUL) \
+    void NAME(const float *d, const float *v, int v_pos, float *u) { \
+        TYPE sum[32 / LANES]; \
+        for (int i = 0; i < 32 / LANES; i++) { \
+            sum[i] = ZERO; \
+        } \
+        int d_index = 512 - (v_pos >> 1); \
+        int v_index = (v_pos % 128) >> 1; \
+        for (; v_index < 1024; v_index += 128, d_index += 64) { \
+            for (int i = 0; i < 32 / LANES; i++) { \
+                TYPE dv = LOAD(d + d_index + i * LANES); \
+                TYPE vv = LOAD(v + v_index + i * LANES); \
+                sum[i] = ADD(sum[i], MUL(dv, vv)); \
+            } \
+        } \
+        d_index -= (512 - 32); \
+        v_index = (128 - 32 + 1024) - v_index; \
+        for (; v_index < 1024; v_index += 128, d_index += 64) { \
+            for (int i = 0; i < 32 / LANES; i++) { \
+                TYPE dv = LOAD(d + d_index + i * LANES); \
+                TYPE vv = LOAD(v + v_index + i * LANES); \
+                sum[i] = ADD(sum[i], MUL(dv, vv)); \
+            } \
+        } \
+        for (int i = 0; i < 32 / LANES; i++) { \
+            STORE(u + i * LANES, sum[i]); \
+        } \
+    }
+
+#ifdef PLM_SIMD_SSE2
+PLM_DEFINE_AUDIO_WINDOW_FUNCTION(
+    plm_audio_window_sse2, __m128, 4, _mm_setzero_ps(),
+    _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, _mm_mul_ps
+)
+#endif // PLM_SIMD_SSE2
+
+#ifdef PLM_SIMD_AVX2
+PLM_TARGET_AVX2 PLM_DEFINE_AUDIO_WINDOW_FUNCTION(
+    plm_audio_window_avx2, __m256, 8, _mm256_setzero_ps(),
+    _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_mul_ps
+)
+#endif // PLM_SIMD_AVX2
+
+#ifdef PLM_SIMD_NEON
+PLM_DEFINE_AUDIO_WINDOW_FUNCTION(
+    plm_audio_window_neon, float32x4_t, 4, vdupq_n_f32(0.0f),
+    vld1q_f32, vst1q_f32, vaddq_f32, vmulq_f32
+)
+#endif // PLM_SIMD_NEON
+
+#undef PLM_DEFINE_AUDIO_WINDOW_FUNCTION
+
+// plm_audio_idct36() is a fast DCT-32 in the style of Lee: each stage folds
+// its input in half into sums and scaled differences, until only pairs are
+// left, and the outputs are then merged back up, with every odd output being
+// the sum of two neighbours of the difference half. The SIMD versions below
+// run the same stages; the first three fold four lanes at a time and the last
+// two work on four groups at once after a 4x4 transpose. Every value is still
+// built from the same operands in the same order, so they match the scalar
+// version exactly.
+
+static const float PLM_AUDIO_IDCT_SCALE_32[] = {
+    0.500602998235f, 0.505470959898f, 0.515447309923f, 0.53104259109f,
+    0.553103896034f, 0.582934968206f, 0.622504123036f, 0.674808341455f,
+    0.744536271002f, 0.839349645416f, 0.972568237862f, 1.16943993343f,
+    1.48416461631f, 2.05778100995f, 3.40760841847f, 10.1900081235f
+};
+
+static const float PLM_AUDIO_IDCT_SCALE_16[] = {
+    0.502419286188f, 0.52249861494f, 0.566944034816f, 0.64682178336f,
+    0.788154623451f, 1.06067768599f, 1.72244709824f, 5.10114861869f
+};
+
+static const float PLM_AUDIO_IDCT_SCALE_8[] = {
+    0.509795579104f, 0.601344886935f, 0.899976223136f, 2.56291544774f
+};
+
+// Everything is spelled out so that the 32 values stay in eight registers.
+// FOLD leaves the sums of A and reversed B in A, and the scaled differences in
+// B. MERGE interleaves the even outputs in A with the odd ones made from B and
+// its successor; the last odd output has no right neighbour, and adding -0.0
+// in its place leaves any value, including signed zeros, untouched.
+
+#define PLM_AUDIO_IDCT_FOLD(TF, A, B, SCALE, ADD, SUB, MUL, REVERSE) do { \
+    TF r_ = REVERSE(B); \
+    TF a_ = ADD(A, r_); \
+    B = MUL(SUB(A, r_), SCALE); \
+    A = a_; \
+    } while(FALSE)
+
+#define PLM_AUDIO_IDCT_MERGE(TF, A, B, BNEXT, LO, HI, ADD, NEXT, ZIPLO, ZIPHI) do { \
+    TF odd_ = ADD(B, NEXT(B, BNEXT)); \
+    LO = ZIPLO(A, odd_); \
+    HI = ZIPHI(A, odd_); \
+    } while(FALSE)
+
+#define PLM_DEFINE_AUDIO_IDCT36_FUNCTION( \
+    NAME, TF, TI, COLUMN, IADD, ISUB, TO_FLOAT, \
+    LOAD, STORE, SET1, ADD, SUB, MUL, NEG, REVERSE, NEXT, ZIPLO, ZIPHI, TRANSPOSE \
+) \
+    static inline void NAME##_dct4(TF *y0, TF *y1, TF *y2, TF *y3) { \
+        TRANSPOSE(*y0, *y1, *y2, *y3); \
+        TF a0 = ADD(*y0, *y3); \
+        TF b0 = MUL(SUB(*y0, *y3), SET1(0.541196100146f)); \
+        TF a1 = ADD(*y1, *y2); \
+        TF b1 = MUL(SUB(*y1, *y2), SET1(1.30656296488f)); \
+        TF e0 = ADD(a0, a1); \
+        TF e1 = MUL(SUB(a0, a1), SET1(0.707106781187f)); \
+        TF f0 = ADD(b0, b1); \
+        TF f1 = MUL(SUB(b0, b1), SET1(0.707106781187f)); \
+        f0 = ADD(f0, f1); \
+        TRANSPOSE(e0, f0, e1, f1); \
+        *y0 = e0; *y1 = f0; *y2 = e1; *y3 = f1; \
+    } \
+    void NAME(int s[32][3], int ss, float *d, int dp) { \
+        TF mz = SET1(-0.0f); \
+        \
+        /* Fold 32 -> 16. The sums and differences are taken as int first */ \
+        TI l0 = COLUMN(s, ss,  0,  1,  2,  3), h0 = COLUMN(s, ss, 31, 30, 29, 28); \
+        TI l1 = COLUMN(s, ss,  4,  5,  6,  7), h1 = COLUMN(s, ss, 27, 26, 25, 24); \
+        TI l2 = COLUMN(s, ss,  8,  9, 10, 11), h2 = COLUMN(s, ss, 23, 22, 21, 20); \
+        TI l3 = COLUMN(s, ss, 12, 13, 14, 15), h3 = COLUMN(s, ss, 19, 18, 17, 16); \
+        TF v0 = TO_FLOAT(IADD(l0, h0)); \
+        TF v1 = TO_FLOAT(IADD(l1, h1)); \
+        TF v2 = TO_FLOAT(IADD(l2, h2)); \
+        TF v3 = TO_FLOAT(IADD(l3, h3)); \
+        TF v4 = MUL(TO_FLOAT(ISUB(l0, h0)), LOAD(PLM_AUDIO_IDCT_SCALE_32 + 0)); \
+        TF v5 = MUL(TO_FLOAT(ISUB(l1, h1)), LOAD(PLM_AUDIO_IDCT_SCALE_32 + 4)); \
+        TF v6 = MUL(TO_FLOAT(ISUB(l2, h2)), LOAD(PLM_AUDIO_IDCT_SCALE_32 + 8)); \
+        TF v7 = MUL(TO_FLOAT(ISUB(l3, h3)), LOAD(PLM_AUDIO_IDCT_SCALE_32 + 12)); \
+        \
+        /* Fold 16 -> 8; the halves end up in (v0 v1) (v3 v2) and likewise above */ \
+        TF scale = LOAD(PLM_AUDIO_IDCT_SCALE_16 + 0); \
+        PLM_AUDIO_IDCT_FOLD(TF, v0, v3, scale, ADD, SUB, MUL, REVERSE); \
+        PLM_AUDIO_IDCT_FOLD(TF, v4, v7, scale, ADD, SUB, MUL, REVERSE); \
+        scale = LOAD(PLM_AUDIO_IDCT_SCALE_16 + 4); \
+        PLM_AUDIO_IDCT_FOLD(TF, v1, v2, scale, ADD, SUB, MUL, REVERSE); \
+        PLM_AUDIO_IDCT_FOLD(TF, v5, v6, scale, ADD, SUB, MUL, REVERSE); \
+        \
+        /* Fold 8 -> 4; leaves the groups of four in v0 v1 v3 v2 v4 v5 v7 v6 */ \
+        scale = LOAD(PLM_AUDIO_IDCT_SCALE_8); \
+        PLM_AUDIO_IDCT_FOLD(TF, v0, v1, scale, ADD, SUB, MUL, REVERSE); \
+        PLM_AUDIO_IDCT_FOLD(TF, v3, v2, scale, ADD, SUB, MUL, REVERSE); \
+        PLM_AUDIO_IDCT_FOLD(TF, v4, v5, scale, ADD, SUB, MUL, REVERSE); \
+        PLM_AUDIO_IDCT_FOLD(TF, v7, v6, scale, ADD, SUB, MUL, REVERSE); \
+        \
+        /* DCT-4 of the groups, four at a time with one in each lane */ \
+        NAME##_dct4(&v0, &v1, &v3, &v2); \
+        NAME##_dct4(&v4, &v5, &v7, &v6); \
+        \
+        /* Merge 4 -> 8 */ \
+        TF w0, w1, w2, w3, w4, w5, w6, w7; \
+        PLM_AUDIO_IDCT_MERGE(TF, v0, v1, mz, w0, w1, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, v3, v2, mz, w2, w3, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, v4, v5, mz, w4, w5, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, v7, v6, mz, w6, w7, ADD, NEXT, ZIPLO, ZIPHI); \
+        \
+        /* Merge 8 -> 16 */ \
+        PLM_AUDIO_IDCT_MERGE(TF, w0, w2, w3, v0, v1, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, w1, w3, mz, v2, v3, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, w4, w6, w7, v4, v5, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, w5, w7, mz, v6, v7, ADD, NEXT, ZIPLO, ZIPHI); \
+        \
+        /* Merge 16 -> 32 */ \
+        PLM_AUDIO_IDCT_MERGE(TF, v0, v4, v5, w0, w1, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, v1, v5, v6, w2, w3, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, v2, v6, v7, w4, w5, ADD, NEXT, ZIPLO, ZIPHI); \
+        PLM_AUDIO_IDCT_MERGE(TF, v3, v7, mz, w6, w7, ADD, NEXT, ZIPLO, ZIPHI); \
+        \
+        /* Output w4..w7 as is, then mirrored and negated, and -w0..w3 \
+           mirrored around d[48] */ \
+        d += dp; \
+        STORE(d +  0, w4); STORE(d + 29, NEG(REVERSE(w4))); \
+        STORE(d +  4, w5); STORE(d + 25, NEG(REVERSE(w5))); \
+        STORE(d +  8, w6); STORE(d + 21, NEG(REVERSE(w6))); \
+        STORE(d + 12, w7); STORE(d + 17, NEG(REVERSE(w7))); \
+        w0 = NEG(w0); w1 = NEG(w1); w2 = NEG(w2); w3 = NEG(w3); \
+        STORE(d + 48, w0); STORE(d + 45, REVERSE(w0)); \
+        STORE(d + 52, w1); STORE(d + 41, REVERSE(w1)); \
+        STORE(d + 56, w2); STORE(d + 37, REVERSE(w2)); \
+        STORE(d + 60, w3); STORE(d + 33, REVERSE(w3)); \
+        d[16] = 0.0f; \
+    }
+
+#ifdef PLM_SIMD_SSE2
+
+// _mm_setr_epi32() tends to be built in general registers and then go
+// through memory, so the column is put together with unpacks instead
+#define PLM_SSE2_COLUMN(S, SS, I0, I1, I2, I3) _mm_unpacklo_epi64( \
+    _mm_unpacklo_epi32(_mm_cvtsi32_si128(S[I0][SS]), _mm_cvtsi32_si128(S[I1][SS])), \
+    _mm_unpacklo_epi32(_mm_cvtsi32_si128(S[I2][SS]), _mm_cvtsi32_si128(S[I3][SS])))
+#define PLM_SSE2_NEG(V) _mm_xor_ps(V, _mm_set1_ps(-0.0f))
+#define PLM_SSE2_REVERSE(V) _mm_shuffle_ps(V, V, _MM_SHUFFLE(0, 1, 2, 3))
+#define PLM_SSE2_TRANSPOSE_PS(R0, R1, R2, R3) _MM_TRANSPOSE4_PS(R0, R1, R2, R3)
+
+// (b1, b2, b3, n0) from b and n
+static inline __m128 plm_audio_idct_next_sse2(__m128 b, __m128 n) {
+    __m128 t = _mm_shuffle_ps(b, n, _MM_SHUFFLE(0, 0, 3, 3));
+    return _mm_shuffle_ps(b, t, _MM_SHUFFLE(2, 0, 2, 1));
+}
+
+PLM_DEFINE_AUDIO_IDCT36_FUNCTION(
+    plm_audio_idct36_sse2, __m128, __m128i, PLM_SSE2_COLUMN,
+    _mm_add_epi32, _mm_sub_epi32, _mm_cvtepi32_ps,
+    _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps,
+    PLM_SSE2_NEG, PLM_SSE2_REVERSE, plm_audio_idct_next_sse2,
+    _mm_unpacklo_ps, _mm_unpackhi_ps, PLM_SSE2_TRANSPOSE_PS
+)
+
+#endif // PLM_SIMD_SSE2
+
+#ifdef PLM_SIMD_NEON
+
+static inline int32x4_t plm_audio_idct_column_neon(int s[32][3], int ss, int i0, int i1, int i2, int i3) {
+    int32x4_t v = vdupq_n_s32(s[i0][ss]);
+    v = vsetq_lane_s32(s[i1][ss], v, 1);
+    v = vsetq_lane_s32(s[i2][ss], v, 2);
+    return vsetq_lane_s32(s[i3][ss], v, 3);
+}
+
+static inline float32x4_t plm_audio_idct_reverse_neon(float32x4_t v) {
+    v = vrev64q_f32(v);
+    return vcombine_f32(vget_high_f32(v), vget_low_f32(v));
+}
+
+#define PLM_NEON_NEXT(B, N) vextq_f32(B, N, 1)
+#define PLM_NEON_ZIPLO(A, B) vzipq_f32(A, B).val[0]
+#define PLM_NEON_ZIPHI(A, B) vzipq_f32(A, B).val[1]
+#define PLM_NEON_TRANSPOSE_PS(R0, R1, R2, R3) do { \
+    float32x4x2_t t0 = vtrnq_f32(R0, R1); \
+    float32x4x2_t t1 = vtrnq_f32(R2, R3); \
+    R0 = vcombine_f32(vget_low_f32(t0.val[0]), vget_low_f32(t1.val[0])); \
+    R1 = vcombine_f32(vget_low_f32(t0.val[1]), vget_low_f32(t1.val[1])); \
+    R2 = vcombine_f32(vget_high_f32(t0.val[0]), vget_high_f32(t1.val[0])); \
+    R3 = vcombine_f32(vget_high_f32(t0.val[1]), vget_high_f32(t1.val[1])); \
+    } while(FALSE)
+
+PLM_DEFINE_AUDIO_IDCT36_FUNCTION(
+    plm_audio_idct36_neon, float32x4_t, int32x4_t, plm_audio_idct_column_neon,
+    vaddq_s32, vsubq_s32, vcvtq_f32_s32,
+    vld1q_f32, vst1q_f32, vdupq_n_f32, vaddq_f32, vsubq_f32, vmulq_f32,
+    vnegq_f32, plm_audio_idct_reverse_neon, PLM_NEON_NEXT,
+    PLM_NEON_ZIPLO, PLM_NEON_ZIPHI, PLM_NEON_TRANSPOSE_PS
+)
+
+#endif // PLM_SIMD_NEON
+
+#undef PLM_DEFINE_AUDIO_IDCT36_FUNCTION
+#undef PLM_AUDIO_IDCT_FOLD
+#undef PLM_AUDIO_IDCT_MERGE
+
+void plm_audio_select_synthesis(plm_audio_t *self) {
+    // The IDCT is only four lanes wide after its first fold, so it has no
+    // AVX2 version
+    #if defined(PLM_SIMD_SSE2)
+        self->idct36 = plm_audio_idct36_sse2;
+        self->window = plm_audio_window_sse2;
+    #elif defined(PLM_SIMD_NEON)
+        self->idct36 = plm_audio_idct36_neon;
+        self->window = plm_audio_window_neon;
+    #else
+        self->idct36 = plm_audio_idct36;
+        self->window = plm_audio_window;
+    #endif
+
+    #ifdef PLM_SIMD_AVX2
+        if (plm_cpu_has_avx2()) {
+            self->window = plm_audio_window_avx2;
+        }
+    #endif
+}
+
+
+// Samples are scaled by 32767 and truncated as they always have been, so any
+// in range and undithered convert to exactly the same values as before. The
+// dither is the difference of two uniform random values, each from the top
+// 24 bits of a xorshift32 state. Sample i always uses state i % 4, so the
+// scalar and SIMD versions produce the same noise and the same output.
+// Truncating towards zero would leave a dead band around zero that dither
+// can't get through, so dithered samples are rounded instead. They're offset
+// to be positive first, where truncating is the same as rounding down.
+
+#define PLM_SAMPLES_SCALE 32767.0f
+#define PLM_SAMPLES_RANDOM_SCALE (1.0f / 16777216.0f)
+#define PLM_SAMPLES_ROUND_OFFSET 32768.5f
+
+static inline uint32_t plm_samples_xorshift(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static inline int16_t plm_samples_convert(float sample, uint32_t *dither) {
+    float v = sample * PLM_SAMPLES_SCALE;
+
+    // Clamps are written so that NaN ends up at the bottom, like SIMD min/max
+    if (dither) {
+        uint32_t r0 = plm_samples_xorshift(*dither);
+        uint32_t r1 = plm_samples_xorshift(r0);
+        *dither = r1;
+        float d0 = (float)(int)(r0 >> 8) * PLM_SAMPLES_RANDOM_SCALE;
+        float d1 = (float)(int)(r1 >> 8) * PLM_SAMPLES_RANDOM_SCALE;
+        v = (v + (d0 - d1)) + PLM_SAMPLES_ROUND_OFFSET;
+        v = v > 0.0f ? v : 0.0f;
+        v = v < 65535.0f ? v : 65535.0f;
+        return (int16_t)((int)v - 32768);
+    }
+    v = v > -32768.0f ? v : -32768.0f;
+    v = v < 32767.0f ? v : 32767.0f;
+    return (int16_t)v;
+}
+
+#define PLM_DEFINE_SAMPLES_TO_S16_FUNCTION( \
+    NAME, TF, TU, TS, LOAD, STORE, STATE_LOAD, STATE_STORE, SET1, ADD, SUB, MUL, MIN, MAX, \
+    XOR, SHL, SHR, RANDOM_TO_FLOAT, TRUNCATE, ISUB, ISET1, PACK \
+) \
+    static inline TF NAME##_dither(TU *state) { \
+        TU r0 = *state; \
+        r0 = XOR(r0, SHL(r0, 13)); r0 = XOR(r0, SHR(r0, 17)); r0 = XOR(r0, SHL(r0, 5)); \
+        TU r1 = r0; \
+        r1 = XOR(r1, SHL(r1, 13)); r1 = XOR(r1, SHR(r1, 17)); r1 = XOR(r1, SHL(r1, 5)); \
+        *state = r1; \
+        TF d0 = MUL(RANDOM_TO_FLOAT(SHR(r0, 8)), SET1(PLM_SAMPLES_RANDOM_SCALE)); \
+        TF d1 = MUL(RANDOM_TO_FLOAT(SHR(r1, 8)), SET1(PLM_SAMPLES_RANDOM_SCALE)); \
+        return SUB(d0, d1); \
+    } \
+    static inline TS NAME##_convert(TF v, TU *state, int dither) { \
+        v = MUL(v, SET1(PLM_SAMPLES_SCALE)); \
+        if (dither) { \
+            v = ADD(ADD(v, NAME##_dither(state)), SET1(PLM_SAMPLES_ROUND_OFFSET)); \
+            v = MAX(v, SET1(0.0f)); \
+            v = MIN(v, SET1(65535.0f)); \
+            return ISUB(TRUNCATE(v), ISET1(32768)); \
+        } \
+        v = MAX(v, SET1(-32768.0f)); \
+        v = MIN(v, SET1(32767.0f)); \
+        return TRUNCATE(v); \
+    } \
+    int NAME(const float *src, int16_t *dest, int count, uint32_t *dither) { \
+        TU state = STATE_LOAD(dither); \
+        int i = 0; \
+        for (; i + 8 <= count; i += 8) { \
+            TS lo = NAME##_convert(LOAD(src + i), &state, dither != NULL); \
+            TS hi = NAME##_convert(LOAD(src + i + 4), &state, dither != NULL); \
+            STORE(dest + i, PACK(lo, hi)); \
+        } \
+        STATE_STORE(dither, state); \
+        return i; \
+    }
+
+#ifdef PLM_SIMD_SSE2
+
+#define PLM_SSE2_STATE_LOAD(P) ((P) ? _mm_loadu_si128((const __m128i *)(P)) : _mm_setzero_si128())
+#define PLM_SSE2_STATE_STORE(P, V) do { \
+    if (P) { \
+        _mm_storeu_si128((__m128i *)(P), V); \
+    } \
+    } while(FALSE)
+#define PLM_SSE2_STORE_S16(P, V) _mm_storeu_si128((__m128i *)(P), V)
+
+PLM_DEFINE_SAMPLES_TO_S16_FUNCTION(
+    plm_samples_to_s16_sse2, __m128, __m128i, __m128i, _mm_loadu_ps, PLM_SSE2_STORE_S16,
+    PLM_SSE2_STATE_LOAD, PLM_SSE2_STATE_STORE, _mm_set1_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps,
+    _mm_min_ps, _mm_max_ps, _mm_xor_si128, _mm_slli_epi32, _mm_srli_epi32, _mm_cvtepi32_ps,
+    _mm_cvttps_epi32, _mm_sub_epi32, _mm_set1_epi32, _mm_packs_epi32
+)
+
+#endif // PLM_SIMD_SSE2
+
+#ifdef PLM_SIMD_NEON
+
+#define PLM_NEON_STATE_LOAD(P) ((P) ? vld1q_u32(P) : vdupq_n_u32(0))
+#define PLM_NEON_STATE_STORE(P, V) do { \
+    if (P) { \
+        vst1q_u32(P, V); \
+    } \
+    } while(FALSE)
+#define PLM_NEON_PACK_S16(LO, HI) vcombine_s16(vqmovn_s32(LO), vqmovn_s32(HI))
+
+PLM_DEFINE_SAMPLES_TO_S16_FUNCTION(
+    plm_samples_to_s16_neon, float32x4_t, uint32x4_t, int32x4_t, vld1q_f32, vst1q_s16,
+    PLM_NEON_STATE_LOAD, PLM_NEON_STATE_STORE, vdupq_n_f32, vaddq_f32, vsubq_f32, vmulq_f32,
+    vminq_f32, vmaxq_f32, veorq_u32, vshlq_n_u32, vshrq_n_u32, vcvtq_f32_u32,
+    vcvtq_s32_f32, vsubq_s32, vdupq_n_s32, PLM_NEON_PACK_S16
+)
+
+#endif // PLM_SIMD_NEON
+
+#undef PLM_DEFINE_SAMPLES_TO_S16_FUNCTION
+
+void plm_samples_to_s16(const float *src, int16_t *dest, int count, uint32_t *dither) {
+    int i = 0;
+    #if defined(PLM_SIMD_SSE2)
+        i = plm_samples_to_s16_sse2(src, dest, count, dither);
+    #elif defined(PLM_SIMD_NEON)
+        i = plm_samples_to_s16_neon(src, dest, count, dither);
+    #endif
+
+    // The SIMD versions stop on a multiple of 8, so lane i % 4 lines up
+    for (; i < count; i++) {
+        dest[i] = plm_samples_convert(src[i], dither ? dither + (i & 3) : NULL);
+    }
+}
+
+// Mixing. The rounding is done the same way as for dithered samples above.
+
+void plm_samples_accumulate_s16_scalar(const int16_t *src, int count, float gain, float *dest) {
+    for (int i = 0; i < count; i++) {
+        dest[i] = dest[i] + (float)src[i] * gain;
+    }
+}
+
+static inline int16_t plm_samples_round(float v) {
+    v = v + PLM_SAMPLES_ROUND_OFFSET;
+    v = v > 0.0f ? v : 0.0f;
+    v = v < 65535.0f ? v : 65535.0f;
+    return (int16_t)((int)v - 32768);
+}
+
+#define PLM_DEFINE_SAMPLES_MIX_FUNCTIONS( \
+    NAME, TF, TS, LOAD, STORE, LOAD_S16, STORE_S16, WIDEN_LO, WIDEN_HI, TO_FLOAT, \
+    SET1, ADD, MUL, MIN, MAX, TRUNCATE, ISUB, ISET1, PACK \
+) \
+    int NAME##_accumulate(const int16_t *src, int count, float gain, float *dest) { \
+        TF g = SET1(gain); \
+        int i = 0; \
+        for (; i + 8 <= count; i += 8) { \
+            TS s = LOAD_S16(src + i); \
+            TF lo = MUL(TO_FLOAT(WIDEN_LO(s)), g); \
+            TF hi = MUL(TO_FLOAT(WIDEN_HI(s)), g); \
+            STORE(dest + i, ADD(LOAD(dest + i), lo)); \
+            STORE(dest + i + 4, ADD(LOAD(dest + i + 4), hi)); \
+        } \
+        return i; \
+    } \
+    int NAME##_round(const float *src, int16_t *dest, int count) { \
+        int i = 0; \
+        for (; i + 8 <= count; i += 8) { \
+            TF lo = ADD(LOAD(src + i), SET1(PLM_SAMPLES_ROUND_OFFSET)); \
+            TF hi = ADD(LOAD(src + i + 4), SET1(PLM_SAMPLES_ROUND_OFFSET)); \
+            lo = MIN(MAX(lo, SET1(0.0f)), SET1(65535.0f)); \
+            hi = MIN(MAX(hi, SET1(0.0f)), SET1(65535.0f)); \
+            STORE_S16(dest + i, PACK( \
+                ISUB(TRUNCATE(lo), ISET1(32768)), \
+                ISUB(TRUNCATE(hi), ISET1(32768)) \
+            )); \
+        } \
+        return i; \
+    }
+
+#ifdef PLM_SIMD_SSE2
+
+#define PLM_SSE2_LOAD_S16(P) _mm_loadu_si128((const __m128i *)(P))
+#define PLM_SSE2_WIDEN_LO(V) _mm_srai_epi32(_mm_unpacklo_epi16(V, V), 16)
+#define PLM_SSE2_WIDEN_HI(V) _mm_srai_epi32(_mm_unpackhi_epi16(V, V), 16)
+
+PLM_DEFINE_SAMPLES_MIX_FUNCTIONS(
+    plm_samples_mix_sse2, __m128, __m128i, _mm_loadu_ps, _mm_storeu_ps,
+    PLM_SSE2_LOAD_S16, PLM_SSE2_STORE_S16, PLM_SSE2_WIDEN_LO, PLM_SSE2_WIDEN_HI, _mm_cvtepi32_ps,
+    _mm_set1_ps, _mm_add_ps, _mm_mul_ps, _mm_min_ps, _mm_max_ps,
+    _mm_cvttps_epi32, _mm_sub_epi32, _mm_set1_epi32, _mm_packs_epi32
+)
+
+#endif // PLM_SIMD_SSE2
+
+#ifdef PLM_SIMD_NEON
+
+#define PLM_NEON_WIDEN_LO(V) vmovl_s16(vget_low_s16(V))
+#define PLM_NEON_WIDEN_HI(V) vmovl_s16(vget_high_s16(V))
+
+PLM_DEFINE_SAMPLES_MIX_FUNCTIONS(
+    plm_samples_mix_neon, float32x4_t, int16x8_t, vld1q_f32, vst1q_f32,
+    vld1q_s16, vst1q_s16, PLM_NEON_WIDEN_LO, PLM_NEON_WIDEN_HI, vcvtq_f32_s32,
+    vdupq_n_f32, vaddq_f32, vmulq_f32, vminq_f32, vmaxq_f32,
+    vcvtq_s32_f32, vsubq_s32, vdupq_n_s32, PLM_NEON_PACK_S16
+)
+
+#endif // PLM_SIMD_NEON
+
+#undef PLM_DEFINE_SAMPLES_MIX_FUNCTIONS
+
+void plm_samples_accumulate_s16(const int16_t *src, int count, float gain, float *dest) {
+    int i = 0;
+    #if defined(PLM_SIMD_SSE2)
+        i = plm_samples_mix_sse2_accumulate(src, count, gain, dest);
+    #elif defined(PLM_SIMD_NEON)
+        i = plm_samples_mix_neon_accumulate(src, count, gain, dest);
+    #endif
+    plm_samples_accumulate_s16_scalar(src + i, count - i, gain, dest + i);
+}
+
+void plm_samples_round_to_s16(const float *src, int16_t *dest, int count) {
+    int i = 0;
+    #if defined(PLM_SIMD_SSE2)
+        i = plm_samples_mix_sse2_round(src, dest, count);
+    #elif defined(PLM_SIMD_NEON)
+        i = plm_samples_mix_neon_round(src, dest, count);
+    #endif
+    for (; i < count; i++) {
+        dest[i] = plm_samples_round(src[i]);
+    }
+}
+
+#undef PLM_SAMPLES_SCALE
+#undef PLM_SAMPLES_RANDOM_SCALE
+#undef PLM_SAMPLES_ROUND_OFFSET
+
+
+
+// -----------------------------------------------------------------------------
+// plm_resampler implementation
+
+// The ratio out/in is reduced to up/down. Output sample k is at k * down in
+// a stream upsampled by up, which falls between input samples k * down / up
+// and the next, at one of up phases. Each phase is the prototype filter
+// sampled at a different offset, so each output sample is a dot product of
+// PLM_RESAMPLER_TAPS input samples and the phase's coefficients. The
+// coefficients are stored in reverse to run over the input in order.
+
+#define PLM_RESAMPLER_TAPS 32
+#define PLM_RESAMPLER_BLOCK 1024
+#define PLM_RESAMPLER_MAX_FACTOR 1024
+#define PLM_RESAMPLER_KAISER_BETA 8.0
+#define PLM_RESAMPLER_PI 3.14159265358979323846
+
+struct plm_resampler_t {
+    int in_rate;
+    int channels;
+    int up;
+    int down;
+    float *coefficients;
+
+    // Input samples per channel, the first TAPS - 1 of which are history.
+    // pos is the newest input sample of the next output and phase its phase.
+    float *buffer[2];
+    int count;
+    int pos;
+    int phase;
+
+    float (*dot)(const float *coefficients, const float *src);
+};
+
+static int plm_resampler_gcd(int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function of the first kind, for the window
+static double plm_resampler_bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+float plm_resampler_dot(const float *coefficients, const float *src) {
+    float sum = 0.0f;
+    for (int i = 0; i < PLM_RESAMPLER_TAPS; i++) {
+        sum += coefficients[i] * src[i];
+    }
+    return sum;
+}
+
+#define PLM_DEFINE_RESAMPLER_DOT_FUNCTION(NAME, TYPE, LANES, ZERO, LOAD, ADD, MUL, HSUM) \
+    float NAME(const float *coefficients, const float *src) { \
+        TYPE sum0 = ZERO, sum1 = ZERO; \
+        for (int i = 0; i < PLM_RESAMPLER_TAPS; i += LANES * 2) { \
+            sum0 = ADD(sum0, MUL(LOAD(coefficients + i), LOAD(src + i))); \
+            sum1 = ADD(sum1, MUL(LOAD(coefficients + i + LANES), LOAD(src + i + LANES))); \
+        } \
+        return HSUM(ADD(sum0, sum1)); \
+    }
+
+#ifdef PLM_SIMD_SSE2
+
+static inline float plm_resampler_hsum_sse2(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+PLM_DEFINE_RESAMPLER_DOT_FUNCTION(
+    plm_resampler_dot_sse2, __m128, 4, _mm_setzero_ps(),
+    _mm_loadu_ps, _mm_add_ps, _mm_mul_ps, plm_resampler_hsum_sse2
+)
+
+#endif // PLM_SIMD_SSE2
+
+#ifdef PLM_SIMD_AVX2
+
+PLM_TARGET_AVX2 static inline float plm_resampler_hsum_avx2(__m256 v) {
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(h);
+}
+
+PLM_TARGET_AVX2 PLM_DEFINE_RESAMPLER_DOT_FUNCTION(
+    plm_resampler_dot_avx2, __m256, 8, _mm256_setzero_ps(),
+    _mm256_loadu_ps, _mm256_add_ps, _mm256_mul_ps, plm_resampler_hsum_avx2
+)
+
+#endif // PLM_SIMD_AVX2
+
+#ifdef PLM_SIMD_NEON
+
+static inline float plm_resampler_hsum_neon(float32x4_t v) {
+    float32x2_t h = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(h, h), 0);
+}
+
+PLM_DEFINE_RESAMPLER_DOT_FUNCTION(
+    plm_resampler_dot_neon, float32x4_t, 4, vdupq_n_f32(0.0f),
+    vld1q_f32, vaddq_f32, vmulq_f32, plm_resampler_hsum_neon
+)
+
+#endif // PLM_SIMD_NEON
+
+#undef PLM_DEFINE_RESAMPLER_DOT_FUNCTION
+
+plm_resampler_t *plm_resampler_create(int in_rate, int out_rate, int channels) {
+    if (in_rate <= 0 || out_rate <= 0 || channels < 1 || channels > 2) {
+        return NULL;
+    }
+
+    int gcd = plm_resampler_gcd(in_rate, out_rate);
+    int up = out_rate / gcd;
+    int down = in_rate / gcd;
+    if (
+        up > PLM_RESAMPLER_MAX_FACTOR || down > PLM_RESAMPLER_MAX_FACTOR ||
+        down > up * 4
+    ) {
+        return NULL;
+    }
+
+    plm_resampler_t *self = (plm_resampler_t *)malloc(sizeof(plm_resampler_t));
+    memset(self, 0, sizeof(plm_resampler_t));
+    self->in_rate = in_rate;
+    self->channels = channels;
+    self->up = up;
+    self->down = down;
+
+    // Windowed sinc, cut off a little below the lower of the two Nyquist 
+    // frequencies. Time is measured in input samples. Each phase is 
+    // normalised to a gain of exactly 1, so there's no ripple at DC.
+    self->coefficients = (float *)malloc(up * PLM_RESAMPLER_TAPS * sizeof(float));
+    double cutoff = 0.45 * (up < down ? (double)up / down : 1.0);
+    double center = (PLM_RESAMPLER_TAPS * up - 1) / 2.0;
+    double half_width = PLM_RESAMPLER_TAPS / 2.0;
+    double window_scale = plm_resampler_bessel_i0(PLM_RESAMPLER_KAISER_BETA);
+    for (int p = 0; p < up; p++) {
+        double h[PLM_RESAMPLER_TAPS];
+        double sum = 0.0;
+        for (int j = 0; j < PLM_RESAMPLER_TAPS; j++) {
+            double t = (p + j * up - center) / up;
+            double x = 2.0 * cutoff * t;
+            double sinc = fabs(x) < 1e-9 ? 1.0 : sin(PLM_RESAMPLER_PI * x) / (PLM_RESAMPLER_PI * x);
+            double r = t / half_width;
+            double w = r * r < 1.0 
+                ? plm_resampler_bessel_i0(PLM_RESAMPLER_KAISER_BETA * sqrt(1.0 - r * r)) / window_scale
+                : 0.0;
+            h[j] = sinc * w;
+            sum += h[j];
+        }
+        for (int j = 0; j < PLM_RESAMPLER_TAPS; j++) {
+            self->coefficients[p * PLM_RESAMPLER_TAPS + (PLM_RESAMPLER_TAPS - 1 - j)] = (float)(h[j] / sum);
+        }
+    }
+
+    for (int c = 0; c < channels; c++) {
+        self->buffer[c] = (float *)malloc((PLM_RESAMPLER_TAPS - 1 + PLM_RESAMPLER_BLOCK) * sizeof(float));
+    }
+    plm_resampler_reset(self);
+
+    #if defined(PLM_SIMD_SSE2)
+        self->dot = plm_resampler_dot_sse2;
+    #elif defined(PLM_SIMD_NEON)
+        self->dot = plm_resampler_dot_neon;
+    #else
+        self->dot = plm_resampler_dot;
+    #endif
+    #ifdef PLM_SIMD_AVX2
+        if (plm_cpu_has_avx2()) {
+            self->dot = plm_resampler_dot_avx2;
+        }
+    #endif
+
+    return self;
+}
+
+void plm_resampler_destroy(plm_resampler_t *self) {
+    for (int c = 0; c < self->channels; c++) {
+        free(self->buffer[c]);
+    }
+    free(self->coefficients);
+    free(self);
+}
+
+void plm_resampler_reset(plm_resampler_t *self) {
+    // Prime the filter history with silence. The output lags the input by
+    // half the filter, as returned by plm_resampler_get_delay()
+    for (int c = 0; c < self->channels; c++) {
+        memset(self->buffer[c], 0, (PLM_RESAMPLER_TAPS - 1) * sizeof(float));
+    }
+    self->count = PLM_RESAMPLER_TAPS - 1;
+    self->pos = PLM_RESAMPLER_TAPS - 1;
+    self->phase = 0;
+}
+
+int plm_resampler_get_output_size(plm_resampler_t *self, int in_count) {
+    return (int)(((int64_t)in_count * self->up) / self->down) + 2;
+}
+
+double plm_resampler_get_delay(plm_resampler_t *self) {
+    double center = (PLM_RESAMPLER_TAPS * self->up - 1) / 2.0;
+    return center / self->up / self->in_rate;
+}
+
+int plm_resampler_process(plm_resampler_t *self, const float *src, int in_count, float *dest) {
+    int channels = self->channels;
+    int written = 0;
+
+    while (in_count > 0) {
+        int block = in_count < PLM_RESAMPLER_BLOCK ? in_count : PLM_RESAMPLER_BLOCK;
+        for (int c = 0; c < channels; c++) {
+            float *dst = self->buffer[c] + self->count;
+            for (int i = 0; i < block; i++) {
+                dst[i] = src[i * channels + c];
+            }
+        }
+        self->count += block;
+        src += block * channels;
+        in_count -= block;
+
+        while (self->pos < self->count) {
+            const float *coefficients = self->coefficients + self->phase * PLM_RESAMPLER_TAPS;
+            int first = self->pos - (PLM_RESAMPLER_TAPS - 1);
+            for (int c = 0; c < channels; c++) {
+                dest[written * channels + c] = self->dot(coefficients, self->buffer[c] + first);
+            }
+            written++;
+
+            self->phase += self->down;
+            self->pos += self->phase / self->up;
+            self->phase %= self->up;
+        }
+
+        // Keep the history needed by the next output. The ratio is limited
+        // so that the next output never starts past the end of the input.
+        int keep_from = self->pos - (PLM_RESAMPLER_TAPS - 1);
+        for (int c = 0; c < channels; c++) {
+            memmove(self->buffer[c], self->buffer[c] + keep_from, (self->count - keep_from) * sizeof(float));
+        }
+        self->count -= keep_from;
+        self->pos -= keep_from;
+    }
+    return written;
+}
+
+#undef PLM_RESAMPLER_TAPS
+#undef PLM_RESAMPLER_BLOCK
+#undef PLM_RESAMPLER_MAX_FACTOR
+#undef PLM_RESAMPLER_KAISER_BETA
+#undef PLM_RESAMPLER_PI
 
 #endif // PL_MPEG_IMPLEMENTATION